@@ -4,21 +4,159 @@
 
 #include <Arduino.h>
 #include "RingBuffer.h"
-
-const uint8_t crc_table_crc8[256] PROGMEM = { 0,213,127,170,254,43,129,84,41,252,86,131,215,2,168,125,82,135,45,248,172,121,211,6,123,174,4,209,133,80,250,47,164,113,219,14,90,143,37,240,141,88,242,39,115,166,12,217,246,35,137,92,8,221,119,162,223,10,160,117,33,244,94,139,157,72,226,55,99,182,28,201,180,97,203,30,74,159,53,224,207,26,176,101,49,228,78,155,230,51,153,76,24,205,103,178,57,236,70,147,199,18,184,109,16,197,111,186,238,59,145,68,107,190,20,193,149,64,234,63,66,151,61,232,188,105,195,22,239,58,144,69,17,196,110,187,198,19,185,108,56,237,71,146,189,104,194,23,67,150,60,233,148,65,235,62,106,191,21,192,75,158,52,225,181,96,202,31,98,183,29,200,156,73,227,54,25,204,102,179,231,50,152,77,48,229,79,154,206,27,177,100,114,167,13,216,140,89,243,38,91,142,36,241,165,112,218,15,32,245,95,138,222,11,161,116,9,220,118,163,247,34,136,93,214,3,169,124,40,253,87,130,255,42,128,85,1,212,126,171,132,81,251,46,122,175,5,208,173,120,210,7,83,134,44,249 };
-#define updateCrc(currentCrc, value) pgm_read_byte(&crc_table_crc8[currentCrc ^ value]);
+#include "src/Crc8.h"
 
 typedef void(*IdleFunction) (bool);
 
+// Largest packet payload accepted, and received payload waiting to be read. SimHub sends up to 32
+// bytes per packet, senders asking for the capabilities with the "arqcaps" expanded command can
+// send bigger ones on boards with enough RAM, cutting the ACK round trips. Bursts of custom
+// protocol data need a few packets of room
+#if defined(__AVR__) && RAMEND < 0x1000
+#define ARQ_MAX_PAYLOAD 32
+#define ARQ_DATA_BUFFER_SIZE 128
+#else
+#define ARQ_MAX_PAYLOAD 128
+#define ARQ_DATA_BUFFER_SIZE 256
+#endif
+
+static_assert(ARQ_DATA_BUFFER_SIZE >= 2 * ARQ_MAX_PAYLOAD, "ARQ data buffer too small for its packets");
+
+// Windowed mode, built with ARQ_ENABLE_WINDOW and enabled with the "arqwindow" expanded command by
+// senders supporting it (SimHub itself only does stop-and-wait, the default). Up to ARQ_WINDOW_SIZE
+// packets can be in flight: the ones arriving after a lost one are kept until it's sent again, and
+// the ACKs and NACKs of all the packets read together are coalesced into one, without waiting for
+// them to be sent:
+// - 0x0B <last in order packet ID> <bitmap of the following packets received out of order>
+// - 0x04 <last in order packet ID> <reason>
+// The window takes ARQ_WINDOW_SIZE * ARQ_MAX_PAYLOAD bytes of RAM
+//#define ARQ_ENABLE_WINDOW
+#if defined(ARQ_ENABLE_WINDOW) && !defined(ARQ_WINDOW_SIZE)
+#define ARQ_WINDOW_SIZE 4
+#endif
+
+// Outgoing bytes are only queued to the USART TX buffer, never waiting for them to be sent
+#ifndef SERIAL_TX_BUFFER_SIZE
+#define SERIAL_TX_BUFFER_SIZE 64
+#endif
+
+// Timeout waiting for the next byte of a packet, from the baud rate and the gaps seen between the
+// bytes, so that a lost byte is NACKed as soon as it's clearly lost. Updated once per packet, the
+// divisions are too slow for every byte at high baud rates
+#define ARQ_MIN_BYTE_TIMEOUT_MS 20
+#define ARQ_MAX_BYTE_TIMEOUT_MS 100
+
+// Timeout waiting for the data of a command, which may have to be NACKed and sent again first, from
+// the round trips seen between an ACK and the next packet. Longer gaps are the sender being idle.
+// The old fixed 400 ms is kept until a few round trips have been measured
+#define ARQ_INITIAL_READ_TIMEOUT_MS 400
+#define ARQ_MIN_READ_TIMEOUT_MS 100
+#define ARQ_MAX_READ_TIMEOUT_MS 2000
+#define ARQ_READ_TIMEOUT_FACTOR 4
+#define ARQ_ROUND_TRIP_SAMPLES 8
+
+// NACK reasons: 0x01 packet ID, 0x02 length, 0x03 CRC, 0x04 CRC mismatch, 0x05 data
+#define ARQ_NACK_REASONS 5
+
+// Packet IDs go from 0 to 128, 255 is for packets out of the sequence
+#define ARQ_SEQUENCE_SIZE 129
+
 class ARQSerial
 {
 private:
 
-	byte partialdatabuffer[24];
+	byte partialdatabuffer[ARQ_MAX_PAYLOAD];
 	int Arq_LastValidPacket = 255;
-	RingBuffer<uint8_t, 32> DataBuffer;
+	RingBuffer<uint8_t, ARQ_DATA_BUFFER_SIZE> DataBuffer;
 	IdleFunction idleFunction = 0;
 
+#ifdef ARQ_ENABLE_WINDOW
+	bool windowed = false;
+	byte windowData[ARQ_WINDOW_SIZE][ARQ_MAX_PAYLOAD];
+	byte windowLength[ARQ_WINDOW_SIZE]; // 0 for free slots
+	byte windowPacketID[ARQ_WINDOW_SIZE];
+	bool ackPending = false;
+	byte nackReason = 0;
+#endif
+	uint8_t txHighWater = 0;
+
+	uint16_t byteTimeUs = 10000000UL / 19200;
+	uint16_t maxByteTimeoutMs = ARQ_MAX_BYTE_TIMEOUT_MS;
+	uint16_t averageGapUs = 0;
+	uint16_t byteTimeoutMs = ARQ_MAX_BYTE_TIMEOUT_MS;
+	unsigned long ackSentMillis = 0;
+	bool awaitingPacket = false;
+	uint16_t averageRoundTripMs = 0;
+	uint8_t roundTripSamples = 0;
+	uint16_t readTimeoutMs = ARQ_INITIAL_READ_TIMEOUT_MS;
+	uint16_t nackCounts[ARQ_NACK_REASONS] = {};
+	uint16_t worstStallMs = 0;
+
+	// Since ResetStatistics(), to measure the goodput at a given baud rate
+	unsigned long statisticsStartMillis = 0;
+	uint16_t statisticsStartOverflows = 0;
+	uint16_t receivedPackets = 0;
+	uint32_t deliveredBytes = 0;
+
+	void UpdateByteTimeout() {
+		uint32_t timeoutMs = 4UL * (byteTimeUs > averageGapUs ? byteTimeUs : averageGapUs) / 1000;
+		if (timeoutMs < ARQ_MIN_BYTE_TIMEOUT_MS) {
+			timeoutMs = ARQ_MIN_BYTE_TIMEOUT_MS;
+		} else if (timeoutMs > maxByteTimeoutMs) {
+			timeoutMs = maxByteTimeoutMs;
+		}
+		byteTimeoutMs = timeoutMs;
+		UpdateReadTimeout();
+	}
+
+	void UpdateReadTimeout() {
+		uint32_t timeoutMs = byteTimeoutMs + (uint32_t)averageRoundTripMs * ARQ_READ_TIMEOUT_FACTOR;
+		uint16_t minTimeoutMs = roundTripSamples < ARQ_ROUND_TRIP_SAMPLES
+			? ARQ_INITIAL_READ_TIMEOUT_MS
+			: ARQ_MIN_READ_TIMEOUT_MS;
+		if (timeoutMs < minTimeoutMs) {
+			timeoutMs = minTimeoutMs;
+		} else if (timeoutMs > ARQ_MAX_READ_TIMEOUT_MS) {
+			timeoutMs = ARQ_MAX_READ_TIMEOUT_MS;
+		}
+		readTimeoutMs = timeoutMs;
+	}
+
+	void TrackAckSent() {
+		ackSentMillis = millis();
+		awaitingPacket = true;
+	}
+
+	void TrackPacketStart() {
+		if (!awaitingPacket) {
+			return;
+		}
+		awaitingPacket = false;
+
+		unsigned long roundTripMs = millis() - ackSentMillis;
+		if (roundTripMs < ARQ_MAX_READ_TIMEOUT_MS) {
+			averageRoundTripMs = (averageRoundTripMs * 7UL + roundTripMs) / 8;
+			if (roundTripSamples < ARQ_ROUND_TRIP_SAMPLES) {
+				roundTripSamples++;
+			}
+		}
+	}
+
+	void TrackStall(unsigned long startMillis) {
+		unsigned long stallMs = millis() - startMillis;
+		if (stallMs > worstStallMs) {
+			worstStallMs = stallMs > 0xFFFF ? 0xFFFF : stallMs;
+		}
+	}
+
+	void TrackTxUsage() {
+		// The ring buffer keeps one slot free, availableForWrite() is SERIAL_TX_BUFFER_SIZE - 1 when empty
+		int used = SERIAL_TX_BUFFER_SIZE - 1 - Serial.availableForWrite();
+		if (used > txHighWater) {
+			txHighWater = used;
+		}
+	}
+
 #ifdef TESTFAIL
 	int testfailidx = 0;
 	int testfailidx2 = 0;
@@ -28,10 +166,14 @@ private:
 	{
 		int c;
 		unsigned long fsr_startMillis = millis();
+		unsigned long fsr_startMicros = micros();
 		do {
 			if (idleFunction != 0) idleFunction(true);
 			c = Serial.read();
 			if (c >= 0) {
+				unsigned long gapUs = micros() - fsr_startMicros;
+				averageGapUs = (averageGapUs * 7UL + (gapUs > 0xFFFF ? 0xFFFF : gapUs)) / 8;
+				TrackStall(fsr_startMillis);
 #ifdef TESTFAIL
 				testfailidx = (testfailidx + 1) % 5000;
 				if (testfailidx == 500)
@@ -42,7 +184,8 @@ private:
 #endif
 				return c;
 			}
-		} while (millis() - fsr_startMillis < 100);
+		} while (millis() - fsr_startMillis < byteTimeoutMs);
+		TrackStall(fsr_startMillis);
 		return -1;
 	}
 
@@ -60,21 +203,32 @@ private:
 
 				header = Arq_TimedRead();
 				if (header != 0x01) {
+					SendPendingAcks();
 					return;
 				}
 
+				receivedPackets++;
+				TrackPacketStart();
+				UpdateByteTimeout();
+
 				if (reason == 0) {
 					packetID = Arq_TimedRead();
 					if (packetID < 0) {
 						reason = 0x01;
 					}
+					else {
+						currentCrc = crc8Update(currentCrc, packetID);
+					}
 				}
 
 				if (reason == 0) {
 					length = Arq_TimedRead();
-					if (length <= 0 || length > 32) {
+					if (length <= 0 || length > ARQ_MAX_PAYLOAD) {
 						reason = 0x02;
 					}
+					else {
+						currentCrc = crc8Update(currentCrc, length);
+					}
 				}
 
 				if (reason == 0)
@@ -83,6 +237,8 @@ private:
 						res = Arq_TimedRead();
 						partialdatabuffer[i] = res;
 						if (res < 0) reason = 0x05;
+						// Computed while waiting for the next byte, not after the last one
+						currentCrc = crc8Update(currentCrc, res);
 					}
 				}
 
@@ -93,24 +249,23 @@ private:
 					}
 				}
 
-				if (reason == 0) {
-					currentCrc = updateCrc(currentCrc, packetID);
-					currentCrc = updateCrc(currentCrc, length);
-					for (i = 0; i < length; i++) {
-						currentCrc = updateCrc(currentCrc, partialdatabuffer[i]);
-					}
-
-					if (crc != currentCrc) {
-						reason = 0x04;
-					}
+				if (reason == 0 && crc != currentCrc) {
+					reason = 0x04;
 				}
 
+#ifdef ARQ_ENABLE_WINDOW
+				if (reason == 0 && windowed) {
+					ReceiveWindowed(packetID, length);
+				}
+				else
+#endif
 				if (reason == 0) {
 					nextpacketid = Arq_LastValidPacket > 127 ? 0 : Arq_LastValidPacket + 1;
 
 					if (packetID == nextpacketid || packetID == 255) {
-						for (i = 0; i < length; i++) {
-							DataBuffer.push(partialdatabuffer[i]);
+						if (!DataBuffer.push(partialdatabuffer, length)) {
+							// No room, don't ACK it so that it gets sent again once read() made some
+							return;
 						}
 						Arq_LastValidPacket = packetID;
 					}
@@ -124,18 +279,129 @@ private:
 #endif
 				}
 
+				if (reason > 0) {
+					nackCounts[reason - 1]++;
+				}
+
+#ifdef ARQ_ENABLE_WINDOW
+				if (reason > 0 && windowed) {
+					nackReason = reason;
+				}
+				else
+#endif
 				if (reason > 0) {
 					SendNAcq(Arq_LastValidPacket, reason);
 				}
 			}
 		}
+
+		SendPendingAcks();
+	}
+
+#ifdef ARQ_ENABLE_WINDOW
+	void ReceiveWindowed(int packetID, int length) {
+		if (packetID == 255) {
+			// No room, don't ACK it so that it gets sent again
+			if (DataBuffer.push(partialdatabuffer, length)) {
+				ackPending = true;
+			}
+			return;
+		}
+
+		ackPending = true;
+
+		if (packetID >= ARQ_SEQUENCE_SIZE) {
+			return;
+		}
+
+		int nextpacketid = Arq_LastValidPacket >= ARQ_SEQUENCE_SIZE - 1 ? 0 : Arq_LastValidPacket + 1;
+		int distance = (packetID - nextpacketid + ARQ_SEQUENCE_SIZE) % ARQ_SEQUENCE_SIZE;
+
+		if (distance == 0) {
+			// DeliverWindow() leaves it in the window when DataBuffer is full, delivering it from there
+			// frees the slot before its ID comes around again
+			if (FindWindowSlot(packetID) < 0) {
+				if (!DataBuffer.push(partialdatabuffer, length)) {
+					// No room, it gets sent again
+					return;
+				}
+				Arq_LastValidPacket = packetID;
+			}
+			DeliverWindow();
+		}
+		else if (distance < ARQ_WINDOW_SIZE && FindWindowSlot(packetID) < 0) {
+			int slot = FindWindowSlot(-1);
+			if (slot >= 0) {
+				memcpy(windowData[slot], partialdatabuffer, length);
+				windowLength[slot] = length;
+				windowPacketID[slot] = packetID;
+			}
+		}
+		// Otherwise it's already been received, just ACK it again
+	}
+
+	// Move the packets following the last in order one from the window to DataBuffer
+	void DeliverWindow() {
+		while (true) {
+			int nextpacketid = Arq_LastValidPacket >= ARQ_SEQUENCE_SIZE - 1 ? 0 : Arq_LastValidPacket + 1;
+			int slot = FindWindowSlot(nextpacketid);
+			if (slot < 0 || !DataBuffer.push(windowData[slot], windowLength[slot])) {
+				return;
+			}
+			windowLength[slot] = 0;
+			Arq_LastValidPacket = nextpacketid;
+		}
+	}
+
+	// Slot holding packetID, or a free slot with -1
+	int FindWindowSlot(int packetID) {
+		for (int slot = 0; slot < ARQ_WINDOW_SIZE; slot++) {
+			if (packetID < 0 ? windowLength[slot] == 0 : windowLength[slot] != 0 && windowPacketID[slot] == packetID) {
+				return slot;
+			}
+		}
+		return -1;
+	}
+
+#endif
+
+	// Coalesced ACK or NACK of the packets read together in windowed mode, then the TX buffer usage
+	void SendPendingAcks() {
+#ifdef ARQ_ENABLE_WINDOW
+		if (nackReason > 0) {
+			Serial.write(0x04);
+			Serial.write((uint8_t)Arq_LastValidPacket);
+			Serial.write(nackReason);
+			TrackAckSent();
+		}
+		else if (ackPending) {
+			// Bit i is for the packet i + 2 after the last in order one, the next one is missing
+			byte received = 0;
+			int packetID = Arq_LastValidPacket >= ARQ_SEQUENCE_SIZE - 1 ? 0 : Arq_LastValidPacket + 1;
+			for (int i = 0; i < ARQ_WINDOW_SIZE - 1; i++) {
+				packetID = packetID >= ARQ_SEQUENCE_SIZE - 1 ? 0 : packetID + 1;
+				if (FindWindowSlot(packetID) >= 0) {
+					received |= 1 << i;
+				}
+			}
+			Serial.write(0x0B);
+			Serial.write((uint8_t)Arq_LastValidPacket);
+			Serial.write(received);
+			TrackAckSent();
+		}
+
+		ackPending = false;
+		nackReason = 0;
+#endif
+		TrackTxUsage();
 	}
 
 	void SendAcq(uint8_t packetId)
 	{
 		Serial.write(0x03);
 		Serial.write(packetId);
-		Serial.flush();
+		TrackAckSent();
+		TrackTxUsage();
 	}
 
 	void SendNAcq(uint8_t lastKnownValidPacket, byte reason)
@@ -143,7 +409,8 @@ private:
 		Serial.write(0x04);
 		Serial.write(lastKnownValidPacket);
 		Serial.write(reason);
-		Serial.flush();
+		TrackAckSent();
+		TrackTxUsage();
 	}
 
 public:
@@ -152,6 +419,92 @@ public:
 		idleFunction = function;
 	}
 
+	// Set the baud rate the timeouts are derived from
+	void SetBaudrate(uint32_t baudrate) {
+		// 10 bits per byte
+		byteTimeUs = 10000000UL / baudrate;
+		// Slow baud rates need more than the usual maximum
+		uint32_t maxTimeoutMs = 4UL * byteTimeUs / 1000;
+		maxByteTimeoutMs = maxTimeoutMs > ARQ_MAX_BYTE_TIMEOUT_MS ? maxTimeoutMs : ARQ_MAX_BYTE_TIMEOUT_MS;
+		averageGapUs = 0;
+		averageRoundTripMs = 0;
+		roundTripSamples = 0;
+		awaitingPacket = false;
+		UpdateByteTimeout();
+	}
+
+	// Start measuring again, e.g. after changing the baud rate
+	void ResetStatistics() {
+		memset(nackCounts, 0, sizeof(nackCounts));
+		worstStallMs = 0;
+		txHighWater = 0;
+		statisticsStartMillis = millis();
+		statisticsStartOverflows = DataBuffer.overflows();
+		receivedPackets = 0;
+		deliveredBytes = 0;
+	}
+
+	// Log the packets received, the bytes delivered and the goodput, the NACKs by reason, the longest
+	// wait for data, the timeouts and the buffers usage since ResetStatistics()
+	void DebugPrintStatistics() {
+		unsigned long elapsedMs = millis() - statisticsStartMillis;
+		// deliveredBytes * 1000 overflows after 4 MB, less than a minute at 1 Mbaud
+		uint32_t goodput = elapsedMs > 0
+			? deliveredBytes / elapsedMs * 1000 + deliveredBytes % elapsedMs * 1000 / elapsedMs
+			: 0;
+
+		String statistics = String("ARQ packets ") + receivedPackets
+			+ ", bytes " + deliveredBytes + " in " + elapsedMs + " ms (" + goodput + " B/s)"
+			+ ", NACKs:";
+		for (int i = 0; i < ARQ_NACK_REASONS; i++) {
+			statistics += String(" ") + (i + 1) + "=" + nackCounts[i];
+		}
+		statistics += String(", worst stall ") + worstStallMs + " ms"
+			+ ", byte timeout " + byteTimeoutMs + " ms"
+			+ ", read timeout " + readTimeoutMs + " ms"
+			+ ", buffer overflows " + (uint16_t)(DataBuffer.overflows() - statisticsStartOverflows)
+			+ ", TX high water " + txHighWater;
+		DebugPrintLn(statistics);
+	}
+
+	// Capabilities, for senders supporting more than SimHub does: the largest payload, then the
+	// window size, 0 without ARQ_ENABLE_WINDOW
+	void WriteCapabilities() {
+		Write(ARQ_MAX_PAYLOAD);
+		Write(EnabledWindowSize());
+	}
+
+	// Switch to windowed mode, return the window size, 0 staying in stop-and-wait when built without
+	// ARQ_ENABLE_WINDOW
+	uint8_t EnableWindow() {
+#ifdef ARQ_ENABLE_WINDOW
+		for (int slot = 0; slot < ARQ_WINDOW_SIZE; slot++) {
+			windowLength[slot] = 0;
+		}
+		windowed = true;
+#endif
+		return EnabledWindowSize();
+	}
+
+	static constexpr uint8_t EnabledWindowSize() {
+#ifdef ARQ_ENABLE_WINDOW
+		return ARQ_WINDOW_SIZE;
+#else
+		return 0;
+#endif
+	}
+
+	// Most bytes ever waiting in the USART TX buffer, SERIAL_TX_BUFFER_SIZE - 1 means it was full and
+	// writes blocked
+	uint8_t TxHighWater() {
+		return txHighWater;
+	}
+
+	// Packets not ACKed because DataBuffer was full
+	uint16_t BufferOverflows() {
+		return DataBuffer.overflows();
+	}
+
 	void CustomPacketStart(byte packetType, uint8_t length) {
 		Serial.write(0x09);
 		Serial.write(packetType);
@@ -164,6 +517,7 @@ public:
 
 	void CustomPacketEnd() {
 		//Serial.write(0x00);
+		TrackTxUsage();
 	}
 
 	int read() {
@@ -174,11 +528,15 @@ public:
 			if (DataBuffer.size() > 0) {
 				uint8_t res = 0;
 				DataBuffer.pop(res);
+				deliveredBytes++;
+				TrackStall(fsr_startMillis);
 				return (int)res;
 			}
 
 			ProcessIncomingData();
-		} while (millis() - fsr_startMillis < 400 || DataBuffer.size() > 0);
+		} while (millis() - fsr_startMillis < readTimeoutMs || DataBuffer.size() > 0);
+
+		TrackStall(fsr_startMillis);
 
 		//DebugPrintLn("Read timeout !");
 		return -1;
@@ -195,7 +553,7 @@ public:
 	void Write(byte data) {
 		Serial.write(0x08);
 		Serial.write(data);
-		Serial.flush();
+		TrackTxUsage();
 	}
 
 	void Print(char data)
@@ -209,7 +567,7 @@ public:
 		Serial.write(len);
 		Serial.write(str);
 		Serial.write(0x20);
-		Serial.flush();
+		TrackTxUsage();
 	}
 
 	void WriteString(String& data)
@@ -219,7 +577,7 @@ public:
 		Serial.write(len);
 		Serial.print(data);
 		Serial.write(0x20);
-		Serial.flush();
+		TrackTxUsage();
 	}
 
 	void PrintString(const char str[]) {
@@ -228,7 +586,7 @@ public:
 		Serial.write(len);
 		Serial.write(str);
 		Serial.write(0x20);
-		Serial.flush();
+		TrackTxUsage();
 	}
 
 	void PrintLn(const char str[]) {
@@ -238,7 +596,7 @@ public:
 		Serial.write(str);
 		Serial.write('\n');
 		Serial.write(0x20);
-		Serial.flush();
+		TrackTxUsage();
 	}
 
 	void PrintLn(String& data)
@@ -248,7 +606,7 @@ public:
 		Serial.print(data);
 		Serial.print('\n');
 		Serial.write(0x20);
-		Serial.flush();
+		TrackTxUsage();
 	}
 
 	void PrintLn() {
@@ -298,7 +656,7 @@ public:
 		Serial.print(data);
 		Serial.print('\n');
 		Serial.write(0x20);
-		Serial.flush();
+		TrackTxUsage();
 	}
 
 	void DebugPrint(char data)
@@ -307,7 +665,7 @@ public:
 		Serial.write(1);
 		Serial.print(data);
 		Serial.write(0x20);
-		Serial.flush();
+		TrackTxUsage();
 	}
 
 	void DebugPrintLn(const char str[]) {
@@ -316,7 +674,7 @@ public:
 		Serial.print(str);
 		Serial.print('\n');
 		Serial.write(0x20);
-		Serial.flush();
+		TrackTxUsage();
 	}
 };
 
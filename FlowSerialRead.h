@@ -2,6 +2,7 @@
 #define FlowSerialFlush Serial.flush
 
 #include "ArqSerial.h"
+#include "src/TokenHash.h"
 ARQSerial arqserial;
 
 #define FlowSerialAvailable() arqserial.Available()
@@ -12,6 +13,23 @@ String FlowSerialReadStringUntil(char terminator) { return arqserial.ReadStringU
 String FlowSerialReadStringUntil(char terminator1, char terminator2) { return arqserial.ReadStringUntil(terminator1, terminator2); }
 void FlowSerialReadStringUntil(char buffer[], char terminator){ arqserial.ReadStringUntil(buffer, terminator); }
 
+// Read the incoming data up to the terminator(s) and hash it, to be compared with tokenHash(). Tokens
+// not fitting in size are read in full but stored empty
+TokenHash FlowSerialReadTokenUntil(char token[], uint8_t size, char terminator1, char terminator2) {
+	TokenHash hash = TOKEN_HASH_SEED;
+	uint8_t length = 0;
+	int c = FlowSerialTimedRead();
+	while (c >= 0 && c != terminator1 && c != terminator2) {
+		hash = tokenHashUpdate(hash, (char)c);
+		if (length < size) {
+			token[length++] = c;
+		}
+		c = FlowSerialTimedRead();
+	}
+	token[length < size ? length : 0] = '\0';
+	return hash;
+}
+
 void FlowSerialPrint(String& data) { arqserial.WriteString(data); }
 void FlowSerialPrint(char data){	arqserial.Print(data);}
 void FlowSerialPrint(const char str[]) {	arqserial.Print(str);}
@@ -21,26 +39,30 @@ void FlowSerialPrintLn(String& data){	arqserial.PrintLn(data);}
 void FlowSerialPrintLn(const char str[]) {	arqserial.PrintLn(str);}
 void FlowSerialPrintLn() { arqserial.PrintLn();}
 
+// Baud rates by the SetBaudrate() code SimHub sends, minus one
+const uint32_t baudrates[] PROGMEM = {
+	300, 1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600,
+	115200, 230400, 250000, 1000000, 2000000, 200000, 500000,
+};
+
+constexpr int BAUDRATES_COUNT = sizeof(baudrates) / sizeof(baudrates[0]);
+
 void SetBaudrate() {
 	int br = FlowSerialTimedRead();
 
+	// Let the pending ACKs out at the current baud rate
+	FlowSerialFlush();
+
+	uint32_t baudrate = 0;
+
 	delay(200);
 
-	if (br == 1) FlowSerialBegin(300);
-	if (br == 2) FlowSerialBegin(1200);
-	if (br == 3) FlowSerialBegin(2400);
-	if (br == 4) FlowSerialBegin(4800);
-	if (br == 5) FlowSerialBegin(9600);
-	if (br == 6) FlowSerialBegin(14400);
-	if (br == 7) FlowSerialBegin(19200);
-	if (br == 8) FlowSerialBegin(28800);
-	if (br == 9) FlowSerialBegin(38400);
-	if (br == 10) FlowSerialBegin(57600);
-	if (br == 11) FlowSerialBegin(115200);
-	if (br == 12) FlowSerialBegin(230400);
-	if (br == 13) FlowSerialBegin(250000);
-	if (br == 14) FlowSerialBegin(1000000);
-	if (br == 15) FlowSerialBegin(2000000);
-	if (br == 16) FlowSerialBegin(200000);
-	if (br == 17) FlowSerialBegin(500000);
+	if (br >= 1 && br <= BAUDRATES_COUNT) {
+		baudrate = pgm_read_dword(&baudrates[br - 1]);
+	}
+
+	if (baudrate > 0) {
+		FlowSerialBegin(baudrate);
+		arqserial.SetBaudrate(baudrate);
+	}
 }
\ No newline at end of file
@@ -47,24 +47,43 @@
 
 #include <Arduino.h>
 
-template <typename rg_element_t, uint8_t __maxSize__>
+/*
+ * Index type of a ring buffer. The indices run freely and are only masked
+ * when accessing the buffer, so that the size is their difference: 8 bits
+ * indices hold up to 128 elements, bigger buffers need 16 bits ones.
+ */
+template <bool __wide__>
+struct RingBufferIndex { typedef uint8_t type; };
+
+template <>
+struct RingBufferIndex<true> { typedef uint16_t type; };
+
+template <typename rg_element_t, uint16_t __maxSize__,
+  typename rg_index_t = typename RingBufferIndex<(__maxSize__ > 128)>::type>
 class RingBuffer
 {
+  static_assert(__maxSize__ > 0 && (__maxSize__ & (__maxSize__ - 1)) == 0,
+    "RingBuffer size must be a power of two");
+  static_assert(__maxSize__ <= ((uint32_t)1 << (sizeof(rg_index_t) * 8 - 1)),
+    "RingBuffer size too big for its index type");
+
 private:
-  rg_element_t mBuffer[__maxSize__];
-  uint8_t mReadIndex;
-  uint8_t mSize;
+  static constexpr rg_index_t mMask = __maxSize__ - 1;
 
-  uint8_t writeIndex();
+  rg_element_t mBuffer[__maxSize__];
+  rg_index_t mReadIndex;
+  rg_index_t mWriteIndex;
+  uint16_t mOverflows;
 
 public:
-  /* Constructor. Init mReadIndex to 0 and mSize to 0 */
+  /* Constructor. Init the indices and the overflow counter to 0 */
   RingBuffer();
   /* Push a data at the end of the buffer */
   bool push(const rg_element_t inElement) __attribute__ ((noinline));
   /* Push a data at the end of the buffer. Copy it from its pointer */
   bool push(const rg_element_t * const inElement) __attribute__ ((noinline));
-  bool push(const rg_element_t* inElements, uint8_t length) __attribute__((noinline));
+  /* Push all the data at the end of the buffer, or nothing if it doesn't fit */
+  bool push(const rg_element_t* inElements, rg_index_t length) __attribute__((noinline));
   /* Push a data at the end of the buffer with interrupts disabled */
   bool lockedPush(const rg_element_t inElement);
   /* Push a data at the end of the buffer with interrupts disabled. Copy it from its pointer */
@@ -73,66 +92,76 @@ public:
   bool pop(rg_element_t &outElement) __attribute__ ((noinline));
   /* Pop the data at the beginning of the buffer */
   bool pop() __attribute__((noinline));
+  /* Pop up to length data at the beginning of the buffer, return how many */
+  rg_index_t pop(rg_element_t* outElements, rg_index_t length) __attribute__((noinline));
   /* Pop the data at the beginning of the buffer with interrupt disabled */
   bool lockedPop(rg_element_t &outElement);
   /* Return true if the buffer is full */
-  bool isFull()  { return mSize == __maxSize__; }
+  bool isFull()  { return size() == __maxSize__; }
   /* Return true if the buffer is empty */
-  bool isEmpty() { return mSize == 0; }
+  bool isEmpty() { return mReadIndex == mWriteIndex; }
   /* Reset the buffer  to an empty state */
-  void clear()   { mSize = 0; }
+  void clear()   { mReadIndex = mWriteIndex; }
   /* return the size of the buffer */
-  uint8_t size() { return mSize; }
+  rg_index_t size() { return (rg_index_t)(mWriteIndex - mReadIndex); }
+  /* return the free space of the buffer */
+  rg_index_t freeSize() { return __maxSize__ - size(); }
   /* return the maximum size of the buffer */
-  uint8_t maxSize() { return __maxSize__; }
+  uint16_t maxSize() { return __maxSize__; }
+  /* return how many pushes failed because the buffer was full */
+  uint16_t overflows() { return mOverflows; }
   /* access the buffer using array syntax, not interrupt safe */
-  rg_element_t &operator[](uint8_t inIndex);
+  rg_element_t &operator[](rg_index_t inIndex);
 };
 
-template <typename rg_element_t, uint8_t __maxSize__>
-uint8_t RingBuffer<rg_element_t, __maxSize__>::writeIndex()
-{
- uint16_t wi = (uint16_t)mReadIndex + (uint16_t)mSize;
- if (wi >= (uint16_t)__maxSize__) wi -= (uint16_t)__maxSize__;
- return (uint8_t)wi;
-}
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+constexpr rg_index_t RingBuffer<rg_element_t, __maxSize__, rg_index_t>::mMask;
 
-template <typename rg_element_t, uint8_t __maxSize__>
-RingBuffer<rg_element_t, __maxSize__>::RingBuffer() :
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+RingBuffer<rg_element_t, __maxSize__, rg_index_t>::RingBuffer() :
 mReadIndex(0),
-mSize(0)
+mWriteIndex(0),
+mOverflows(0)
 {
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-bool RingBuffer<rg_element_t, __maxSize__>::push(const rg_element_t inElement)
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+bool RingBuffer<rg_element_t, __maxSize__, rg_index_t>::push(const rg_element_t inElement)
 {
-  if (isFull()) return false;
-  mBuffer[writeIndex()] = inElement;
-  mSize++;
+  if (isFull()) {
+    mOverflows++;
+    return false;
+  }
+  mBuffer[mWriteIndex & mMask] = inElement;
+  mWriteIndex++;
   return true;
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-bool RingBuffer<rg_element_t, __maxSize__>::push(const rg_element_t* inElements, uint8_t length)
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+bool RingBuffer<rg_element_t, __maxSize__, rg_index_t>::push(const rg_element_t* inElements, rg_index_t length)
 {
-	if (isFull()) return false;
-	memcpy(mBuffer + writeIndex(), inElements, length);
-	mSize+=length;
-	return true;
+  if (length > freeSize()) {
+    mOverflows++;
+    return false;
+  }
+  /* Copy up to the end of the buffer, then from its beginning */
+  rg_index_t writeIndex = mWriteIndex & mMask;
+  rg_index_t firstLength = __maxSize__ - writeIndex;
+  if (firstLength > length) firstLength = length;
+  memcpy(mBuffer + writeIndex, inElements, firstLength * sizeof(rg_element_t));
+  memcpy(mBuffer, inElements + firstLength, (length - firstLength) * sizeof(rg_element_t));
+  mWriteIndex += length;
+  return true;
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-bool RingBuffer<rg_element_t, __maxSize__>::push(const rg_element_t * const inElement)
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+bool RingBuffer<rg_element_t, __maxSize__, rg_index_t>::push(const rg_element_t * const inElement)
 {
-  if (isFull()) return false;
-  mBuffer[writeIndex()] = *inElement;
-  mSize++;
-  return true;
+  return push(*inElement);
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-bool RingBuffer<rg_element_t, __maxSize__>::lockedPush(const rg_element_t inElement)
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+bool RingBuffer<rg_element_t, __maxSize__, rg_index_t>::lockedPush(const rg_element_t inElement)
 {
   noInterrupts();
   bool result = push(inElement);
@@ -140,8 +169,8 @@ bool RingBuffer<rg_element_t, __maxSize__>::lockedPush(const rg_element_t inElem
   return result;
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-bool RingBuffer<rg_element_t, __maxSize__>::lockedPush(const rg_element_t * const inElement)
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+bool RingBuffer<rg_element_t, __maxSize__, rg_index_t>::lockedPush(const rg_element_t * const inElement)
 {
   noInterrupts();
   bool result = push(inElement);
@@ -149,29 +178,39 @@ bool RingBuffer<rg_element_t, __maxSize__>::lockedPush(const rg_element_t * cons
   return result;
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-bool RingBuffer<rg_element_t, __maxSize__>::pop(rg_element_t &outElement)
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+bool RingBuffer<rg_element_t, __maxSize__, rg_index_t>::pop(rg_element_t &outElement)
+{
+  if (isEmpty()) return false;
+  outElement = mBuffer[mReadIndex & mMask];
+  mReadIndex++;
+  return true;
+}
+
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+bool RingBuffer<rg_element_t, __maxSize__, rg_index_t>::pop()
 {
   if (isEmpty()) return false;
-  outElement = mBuffer[mReadIndex];
   mReadIndex++;
-  mSize--;
-  if (mReadIndex == __maxSize__) mReadIndex = 0;
   return true;
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-bool RingBuffer<rg_element_t, __maxSize__>::pop()
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+rg_index_t RingBuffer<rg_element_t, __maxSize__, rg_index_t>::pop(rg_element_t* outElements, rg_index_t length)
 {
-	if (isEmpty()) return false;
-	mReadIndex++;
-	mSize--;
-	if (mReadIndex == __maxSize__) mReadIndex = 0;
-	return true;
+  if (length > size()) length = size();
+  /* Copy up to the end of the buffer, then from its beginning */
+  rg_index_t readIndex = mReadIndex & mMask;
+  rg_index_t firstLength = __maxSize__ - readIndex;
+  if (firstLength > length) firstLength = length;
+  memcpy(outElements, mBuffer + readIndex, firstLength * sizeof(rg_element_t));
+  memcpy(outElements + firstLength, mBuffer, (length - firstLength) * sizeof(rg_element_t));
+  mReadIndex += length;
+  return length;
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-bool RingBuffer<rg_element_t, __maxSize__>::lockedPop(rg_element_t &outElement)
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+bool RingBuffer<rg_element_t, __maxSize__, rg_index_t>::lockedPop(rg_element_t &outElement)
 {
   noInterrupts();
   bool result = pop(outElement);
@@ -179,13 +218,11 @@ bool RingBuffer<rg_element_t, __maxSize__>::lockedPop(rg_element_t &outElement)
   return result;
 }
 
-template <typename rg_element_t, uint8_t __maxSize__>
-rg_element_t &RingBuffer<rg_element_t, __maxSize__>::operator[](uint8_t inIndex)
+template <typename rg_element_t, uint16_t __maxSize__, typename rg_index_t>
+rg_element_t &RingBuffer<rg_element_t, __maxSize__, rg_index_t>::operator[](rg_index_t inIndex)
 {
-  if (inIndex >= mSize) return mBuffer[0];
-  uint16_t index = (uint16_t)mReadIndex + (uint16_t)inIndex;
-  if (index >= (uint16_t)__maxSize__) index -= (uint16_t)__maxSize__;
-  return mBuffer[(uint8_t)index];
+  if (inIndex >= size()) return mBuffer[0];
+  return mBuffer[(rg_index_t)(mReadIndex + inIndex) & mMask];
 }
 
 #endif /* __RINGBUFFER_H__ */
\ No newline at end of file
@@ -56,6 +56,68 @@ void Command_EncodersCount() {
 #endif
 }
 
+void Command_RpmAndSpeedLatency() {
+	shCustomProtocol.printRpmAndSpeedLatency();
+}
+
+void Command_NewTrip() {
+	shCustomProtocol.startNewTrip();
+}
+
+void Command_ClearLastTrip() {
+	shCustomProtocol.clearLastTrip();
+}
+
+void Command_NCalc() {
+	shCustomProtocol.printNCalc();
+}
+
+volatile uint8_t crc8BenchmarkSink;
+
+template <uint8_t (*update)(uint8_t, uint8_t)>
+uint32_t Crc8BenchmarkMicros() {
+	uint8_t crc = 0;
+	uint32_t start = micros();
+	for (uint16_t i = 0; i < 1024; i++) {
+		crc = update(crc, (uint8_t)i);
+	}
+	uint32_t elapsed = micros() - start;
+	crc8BenchmarkSink = crc;
+	return elapsed;
+}
+
+// Log the time each CRC-8 implementation takes for 1 KB
+void Command_Crc8Benchmark() {
+	String result = String("CRC-8 us/KB: PROGMEM table ") + Crc8BenchmarkMicros<crc8UpdateProgmemTable>()
+		+ ", nibble tables " + Crc8BenchmarkMicros<crc8UpdateNibbleTables>()
+		+ ", bitwise " + Crc8BenchmarkMicros<crc8UpdateBitwise>();
+	FlowSerialDebugPrintLn(result);
+}
+
+void Command_ArqCapabilities() {
+	arqserial.WriteCapabilities();
+}
+
+void Command_ArqStatistics() {
+	arqserial.DebugPrintStatistics();
+}
+
+void Command_ArqResetStatistics() {
+	arqserial.ResetStatistics();
+}
+
+// Discard the data up to the end of the line, to measure the goodput with arqreset and arqstats
+void Command_ArqSink() {
+	int c;
+	do {
+		c = FlowSerialTimedRead();
+	} while (c >= 0 && c != '\n');
+}
+
+void Command_ArqWindow() {
+	FlowSerialWrite(arqserial.EnableWindow());
+}
+
 void Command_SpeedoData() {
 #ifdef INCLUDE_SPEEDOGAUGE
 	speedoTonePin.readFromString();
@@ -260,6 +322,8 @@ void Command_Motors() {
 }
 
 void Command_Shutdown() {
+	shCustomProtocol.shutdown();
+
 #if	defined(INCLUDE_DM163_MATRIX)
 	if (DM163_MATRIX_ENABLED > 0) {
 		shRGBLedsDM163.clear();
@@ -400,7 +464,7 @@ void Command_I2CLCDData() {
 #endif
 }
 
+// The data is parsed by the loop as it arrives, see SHCustomProtocol::poll()
 void Command_CustomProtocolData() {
 	shCustomProtocol.read();
-	FlowSerialWrite(0x15);
 }
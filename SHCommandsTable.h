@@ -0,0 +1,124 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// Commands, by the opcode following MESSAGE_HEADER. Add a line to register a new one
+#define SH_COMMANDS(COMMAND) \
+	COMMAND('0', Command_Features) \
+	COMMAND('1', Command_Hello) \
+	COMMAND('2', Command_TM1638Count) \
+	COMMAND('3', Command_TM1638Data) \
+	COMMAND('4', Command_RGBLEDSCount) \
+	COMMAND('6', Command_RGBLEDSData) \
+	COMMAND('8', Command_SetBaudrate) \
+	COMMAND('A', Command_Acq) \
+	COMMAND('B', Command_SimpleModulesCount) \
+	COMMAND('G', Command_GearData) \
+	COMMAND('I', Command_UniqueId) \
+	COMMAND('J', Command_ButtonsCount) \
+	COMMAND('K', Command_GLCDData) /* Nokia | OLEDS */ \
+	COMMAND('L', Command_I2CLCDData) \
+	COMMAND('M', Command_MatrixData) \
+	COMMAND('N', Command_DeviceName) \
+	COMMAND('P', Command_CustomProtocolData) \
+	COMMAND('R', Command_RGBMatrixData) \
+	COMMAND('S', Command_7SegmentsData) \
+	COMMAND('V', Command_Motors) \
+	COMMAND('X', Command_ExpandedCommand)
+
+// Expanded commands, by the name following the 'X' opcode. Add a line to register a new one
+#define SH_EXPANDED_COMMANDS(COMMAND) \
+	COMMAND("list", Command_ExpandedCommandsList) \
+	COMMAND("mcutype", Command_MCUType) \
+	COMMAND("tach", Command_TachData) \
+	COMMAND("speedo", Command_SpeedoData) \
+	COMMAND("boost", Command_BoostData) \
+	COMMAND("temp", Command_TempData) \
+	COMMAND("fuel", Command_FuelData) \
+	COMMAND("cons", Command_ConsData) \
+	COMMAND("encoderscount", Command_EncodersCount) \
+	COMMAND("ncalc", Command_NCalc) \
+	COMMAND("latency", Command_RpmAndSpeedLatency) \
+	COMMAND("newtrip", Command_NewTrip) \
+	COMMAND("cleartrip", Command_ClearLastTrip) \
+	COMMAND("arqwindow", Command_ArqWindow) \
+	COMMAND("arqcaps", Command_ArqCapabilities) \
+	COMMAND("arqstats", Command_ArqStatistics) \
+	COMMAND("arqreset", Command_ArqResetStatistics) \
+	COMMAND("arqsink", Command_ArqSink) \
+	COMMAND("crcbench", Command_Crc8Benchmark)
+
+typedef void (*CommandHandler)();
+
+constexpr uint8_t EXPANDED_COMMAND_MAX_LENGTH = 15;
+
+#define SH_EXPANDED_COMMAND_LENGTH(name, handler) \
+	static_assert(sizeof(name) <= EXPANDED_COMMAND_MAX_LENGTH + 1, "Expanded command name too long");
+SH_EXPANDED_COMMANDS(SH_EXPANDED_COMMAND_LENGTH)
+#undef SH_EXPANDED_COMMAND_LENGTH
+
+// Two expanded commands with the same hash would be duplicate case labels. An unknown command may
+// hash like a known one though, so the name confirms the match
+void Command_ExpandedCommand() {
+	char name[EXPANDED_COMMAND_MAX_LENGTH + 1];
+
+	switch (FlowSerialReadTokenUntil(name, sizeof(name), ' ', '\n')) {
+#define SH_EXPANDED_COMMAND_CASE(commandName, handler) \
+		case tokenHash(commandName): \
+			if (strcmp_P(name, PSTR(commandName)) == 0) { \
+				handler(); \
+			} \
+			break;
+		SH_EXPANDED_COMMANDS(SH_EXPANDED_COMMAND_CASE)
+#undef SH_EXPANDED_COMMAND_CASE
+	}
+}
+
+constexpr CommandHandler getCommandHandler(uint8_t opcode) {
+	return
+#define SH_COMMAND_HANDLER(commandOpcode, handler) opcode == commandOpcode ? handler :
+		SH_COMMANDS(SH_COMMAND_HANDLER)
+#undef SH_COMMAND_HANDLER
+		nullptr;
+}
+
+// Jump table from '0' to '_', covering every opcode SimHub uses
+#define SH_COMMAND_HANDLERS_8(first) \
+	getCommandHandler(first), getCommandHandler(first + 1), \
+	getCommandHandler(first + 2), getCommandHandler(first + 3), \
+	getCommandHandler(first + 4), getCommandHandler(first + 5), \
+	getCommandHandler(first + 6), getCommandHandler(first + 7)
+
+constexpr uint8_t FIRST_COMMAND_OPCODE = '0';
+
+const CommandHandler commandHandlers[] PROGMEM = {
+	SH_COMMAND_HANDLERS_8('0'),
+	SH_COMMAND_HANDLERS_8('8'),
+	SH_COMMAND_HANDLERS_8('@'),
+	SH_COMMAND_HANDLERS_8('H'),
+	SH_COMMAND_HANDLERS_8('P'),
+	SH_COMMAND_HANDLERS_8('X'),
+};
+
+#undef SH_COMMAND_HANDLERS_8
+
+constexpr uint8_t COMMAND_OPCODES_COUNT = sizeof(commandHandlers) / sizeof(commandHandlers[0]);
+
+#define SH_COMMAND_IN_TABLE(commandOpcode, handler) \
+	static_assert(commandOpcode >= FIRST_COMMAND_OPCODE && commandOpcode < FIRST_COMMAND_OPCODE + COMMAND_OPCODES_COUNT, \
+		"Command opcode out of the jump table");
+SH_COMMANDS(SH_COMMAND_IN_TABLE)
+#undef SH_COMMAND_IN_TABLE
+
+void DispatchCommand(uint8_t opcode) {
+	uint8_t index = opcode - FIRST_COMMAND_OPCODE;
+	if (index >= COMMAND_OPCODES_COUNT) {
+		return;
+	}
+
+	CommandHandler handler = (CommandHandler)pgm_read_ptr(&commandHandlers[index]);
+	if (handler != nullptr) {
+		handler();
+	}
+}
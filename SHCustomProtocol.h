@@ -6,8 +6,15 @@
 #pragma once
 
 #include <Arduino.h>
+#include "src/CanTrace.h"
 #include "src/Cluster.h"
+#include "src/MessageParser.h"
+#include "src/Mcp2515CanBus.h"
+#include "src/NeedleSmoother.h"
+#include "src/Persistence.h"
+#include "src/StateFields.h"
 #include "src/StateHolder.h"
+#include "src/TripComputer.h"
 #include "src/types.h"
 
 // Uncomment which cluster you wanna control
@@ -15,10 +22,150 @@
 //#include "src/clusters/peugeot_208_i/Cluster.h"
 //#include "src/clusters/peugeot_3008_i/Cluster.h"
 //#include "src/clusters/peugeot_multifunction_display/Cluster.h"
+
+// One MCP2515 per cluster, each one on its own SPI chip select pin, plus optionally the pin its INT
+// line is wired to (pin 2 or 3 on an Arduino Uno) to read received frames without polling
+static Mcp2515CanBus canBus0(10);
+//static Mcp2515CanBus canBus1(9, 3);
+
+// Optionally record a bus in candump -l format to a serial port other than the SimHub one, binding
+// the cluster to the recorder instead of the bus
+//static CanTraceRecorder canTrace0(canBus0, Serial1, "can0");
+
+// Uncomment the cluster(s) you included above and bind them to their CAN bus
+//static CitroenC5IICluster citroenC5IICluster(canBus0);
+//static Peugeot208ICluster peugeot208ICluster(canBus0);
+//static Peugeot3008ICluster peugeot3008ICluster(canBus0);
+//static PeugeotMultifunctionDisplayCluster peugeotMultifunctionDisplayCluster(canBus1);
+
+static Cluster *const clusters[] = {
+	//&citroenC5IICluster,
+	//&peugeot208ICluster,
+	//&peugeot3008ICluster,
+	//&peugeotMultifunctionDisplayCluster,
+};
+
+// Uncomment the cluster(s) you bound above, SimHub only sends the fields they use
+static constexpr StateFieldMask parsedFields = 0
+	//| CitroenC5IICluster::CONSUMED_FIELDS
+	//| Peugeot208ICluster::CONSUMED_FIELDS
+	//| Peugeot3008ICluster::CONSUMED_FIELDS
+	//| PeugeotMultifunctionDisplayCluster::CONSUMED_FIELDS
+	;
+
+// Uncomment to send the RPM and the speed to the clusters as soon as SimHub sends them, instead of
+// smoothing the needles between SimHub updates, for the shift lights and the needles to follow the
+// game as tightly as the CAN bus allows
+//#define LOW_LATENCY_RPM_AND_SPEED
 // End selection
 
 class SHCustomProtocol {
 private:
+	// Needles move smoothly between SimHub updates
+	NeedleSmoother rpmSmoother;
+	NeedleSmoother speedSmoother;
+
+	// The message is parsed as it arrives, between loops, and applied once complete
+	static constexpr uint16_t MESSAGE_TIMEOUT_MS = 500;
+	MessageParser<parsedFields> parser;
+	uint32_t lastMessageByteMs = 0;
+
+	// The trip is only integrated while messages keep coming, the last speed isn't driven forever
+	bool receivingMessages = false;
+	uint32_t lastCommitMs = 0;
+
+	// From the header of the custom protocol command to the RPM and speed frame, when sent right away
+	// or as soon as the cluster could take it
+	static constexpr uint8_t CLUSTERS_COUNT = sizeof(clusters) / sizeof(clusters[0]);
+	static_assert(CLUSTERS_COUNT <= 8, "Too many clusters for deferredRpmAndSpeedClusters");
+	uint32_t messageStartUs = 0;
+	uint8_t deferredRpmAndSpeedClusters = 0;
+	uint32_t lastRpmAndSpeedLatencyUs = 0;
+	uint32_t maxRpmAndSpeedLatencyUs = 0;
+	uint16_t sentRpmAndSpeedFrames = 0;
+	uint16_t deferredRpmAndSpeedFrames = 0;
+
+	// Averages, duration and range are computed here instead of being sent by SimHub
+	TripComputer tripComputer;
+
+	// SimHub only tells whether TC and ABS are intervening right now, keep them active for a while
+	// so that the lights are noticeable
+	static constexpr uint16_t FEATURE_ACTIVE_HOLD_MS = 1000;
+	bool tcActive = false;
+	uint32_t tcLastActiveMs = 0;
+	bool absActive = false;
+	uint32_t absLastActiveMs = 0;
+
+	// SimHub only knows the distance driven in the current session, add what is driven to the saved
+	// odometer. The first value is only a reference, the Arduino may restart in the middle of a session
+	bool sessionOdometerKnown = false;
+	uint32_t lastSessionOdometerKm = 0;
+
+	static FeatureStatus getHeldFeatureStatus(bool &active, uint32_t lastActiveMs, uint32_t currentTime) {
+		if (active && currentTime - lastActiveMs >= FEATURE_ACTIVE_HOLD_MS) {
+			active = false;
+		}
+
+		return active ? FeatureStatus::ACTIVE : FeatureStatus::ENABLED;
+	}
+
+	static constexpr bool isParsed(StateField field) {
+		return parsedFields & stateFieldBit(field);
+	}
+
+	// The range is computed for the car of the first cluster
+	static uint8_t getTankCapacityLiters() {
+		for (Cluster *cluster : clusters) {
+			return cluster->getTankCapacityLiters();
+		}
+		return 0;
+	}
+
+	// SimHub stopped sending data, the car isn't moving anymore
+	void stopReceivingMessages(State &state, uint32_t currentTime) {
+		receivingMessages = false;
+		state.speedKmh = 0;
+		speedSmoother.setTarget(0, currentTime);
+	}
+
+	// Every cluster shares the same state, each one with its own scheduling
+	void updateClusters(State &state) {
+		for (uint8_t i = 0; i < CLUSTERS_COUNT; i++) {
+			clusters[i]->updateState(state);
+
+			if ((deferredRpmAndSpeedClusters & (1 << i)) && !clusters[i]->isRpmAndSpeedDeferred()) {
+				deferredRpmAndSpeedClusters &= ~(1 << i);
+				recordRpmAndSpeedLatency();
+			}
+		}
+	}
+
+	// Send the RPM and the speed just parsed without waiting for the next loop, unless a cluster got
+	// a frame too recently
+	void updateRpmAndSpeed(State &state) {
+		for (uint8_t i = 0; i < CLUSTERS_COUNT; i++) {
+			switch (clusters[i]->updateRpmAndSpeed(state)) {
+				case ExpeditedFrameStatus::SENT:
+					deferredRpmAndSpeedClusters &= ~(1 << i);
+					recordRpmAndSpeedLatency();
+					sentRpmAndSpeedFrames++;
+					break;
+				case ExpeditedFrameStatus::DEFERRED:
+					deferredRpmAndSpeedClusters |= 1 << i;
+					deferredRpmAndSpeedFrames++;
+					break;
+				case ExpeditedFrameStatus::NOT_SUPPORTED:
+					break;
+			}
+		}
+	}
+
+	void recordRpmAndSpeedLatency() {
+		lastRpmAndSpeedLatencyUs = micros() - messageStartUs;
+		if (lastRpmAndSpeedLatencyUs > maxRpmAndSpeedLatencyUs) {
+			maxRpmAndSpeedLatencyUs = lastRpmAndSpeedLatencyUs;
+		}
+	}
 
 public:
 
@@ -47,64 +194,57 @@ public:
 
 	// Called when starting the arduino (setup method in main sketch)
 	void setup() {
-		Cluster::setup();
+		for (Cluster *cluster : clusters) {
+			cluster->setup();
+		}
 
 		State &state = StateHolder::getState();
 
-		Cluster::updateState(state);
+		Persistence::restore(state);
+
+		updateClusters(state);
 
 		state.dashboardLightingEnabled = true;
 		state.dashboardBrightness = 0x0F;
 
-		Cluster::updateState(state);
+		updateClusters(state);
 	}
 
-	// Called when new data is coming from computer
-	void read() {
+	// Apply the message parsed, in the order the fields are sent
+	void commit() {
 		State &state = StateHolder::getState();
 
-		String temperatureUnit = FlowSerialReadStringUntil(';');
-		if (temperatureUnit == "Celcius") {
-			state.locale.temperatureUnit = TemperatureUnit::CELSIUS;
-		} else if (temperatureUnit == "Fahrenheit") {
-			state.locale.temperatureUnit = TemperatureUnit::FAHRENHEIT;
-		} else if (temperatureUnit == "Kelvin") {
-			state.locale.temperatureUnit = TemperatureUnit::KELVIN;
-		} else {
-			FlowSerialDebugPrintLn("Unknown temperature unit: " + temperatureUnit);
-			state.locale.temperatureUnit = TemperatureUnit::CELSIUS;
+		// Unknown units fall back to the first one
+		if (isParsed(StateField::TEMPERATURE_UNIT)) {
+			int8_t unit = parser.nextToken();
+			if (unit < 0) {
+				FlowSerialDebugPrintLn("Unknown temperature unit");
+			}
+			state.locale.temperatureUnit = unit < 0 ? TemperatureUnit::CELSIUS : (TemperatureUnit)unit;
 		}
 
-		String pressureUnit = FlowSerialReadStringUntil(';');
-		if (pressureUnit == "Bar") {
-			state.locale.pressureUnit = PressureUnit::BAR;
-		} else if (pressureUnit == "Kpa") {
-			state.locale.pressureUnit = PressureUnit::KPA;
-		} else if (pressureUnit == "Psi") {
-			state.locale.pressureUnit = PressureUnit::PSI;
-		} else {
-			FlowSerialDebugPrintLn("Unknown pressure unit: " + pressureUnit);
-			state.locale.pressureUnit = PressureUnit::BAR;
+		if (isParsed(StateField::PRESSURE_UNIT)) {
+			int8_t unit = parser.nextToken();
+			if (unit < 0) {
+				FlowSerialDebugPrintLn("Unknown pressure unit");
+			}
+			state.locale.pressureUnit = unit < 0 ? PressureUnit::BAR : (PressureUnit)unit;
 		}
 
-		String volumeUnit = FlowSerialReadStringUntil(';');
-		if (volumeUnit == "Liters") {
-			state.locale.volumeUnit = VolumeUnit::LITERS;
-		} else if (volumeUnit == "Gallons") {
-			state.locale.volumeUnit = VolumeUnit::GALLONS;
-		} else {
-			FlowSerialDebugPrintLn("Unknown volume unit: " + volumeUnit);
-			state.locale.volumeUnit = VolumeUnit::LITERS;
+		if (isParsed(StateField::VOLUME_UNIT)) {
+			int8_t unit = parser.nextToken();
+			if (unit < 0) {
+				FlowSerialDebugPrintLn("Unknown volume unit");
+			}
+			state.locale.volumeUnit = unit < 0 ? VolumeUnit::LITERS : (VolumeUnit)unit;
 		}
 
-		String speedUnit = FlowSerialReadStringUntil(';');
-		if (speedUnit == "KMH") {
-			state.locale.distanceUnit = DistanceUnit::KILOMETERS;
-		} else if (speedUnit == "MPH") {
-			state.locale.distanceUnit = DistanceUnit::MILES;
-		} else {
-			FlowSerialDebugPrintLn("Unknown speed unit: " + speedUnit);
-			state.locale.distanceUnit = DistanceUnit::KILOMETERS;
+		if (isParsed(StateField::SPEED_UNIT)) {
+			int8_t unit = parser.nextToken();
+			if (unit < 0) {
+				FlowSerialDebugPrintLn("Unknown speed unit");
+			}
+			state.locale.distanceUnit = unit < 0 ? DistanceUnit::KILOMETERS : (DistanceUnit)unit;
 		}
 
 		if (state.locale.volumeUnit == VolumeUnit::GALLONS &&
@@ -114,87 +254,229 @@ public:
 			state.locale.consumptionUnit = ConsumptionUnit::VOLUME_PER_DISTANCE;
 		}
 
-		state.ignitionState = FlowSerialReadStringUntil(';').toInt()
-			? IgnitionState::ON
-			: IgnitionState::OFF;
+		if (isParsed(StateField::IGNITION)) {
+			state.ignitionState = parser.nextInteger()
+				? IgnitionState::ON
+				: IgnitionState::OFF;
+		}
 
-		state.engineStarted = !!FlowSerialReadStringUntil(';').toInt();
+		if (isParsed(StateField::ENGINE_STARTED)) {
+			state.engineStarted = !!parser.nextInteger();
+		}
 
-		state.rpm = FlowSerialReadStringUntil(';').toInt();
+		if (isParsed(StateField::RPM)) {
+			state.rpm = parser.nextInteger();
+			rpmSmoother.setTarget(state.rpm, millis());
+		}
 
-		state.speedKmh = FlowSerialReadStringUntil(';').toInt();
+		if (isParsed(StateField::SPEED)) {
+			state.speedKmh = parser.nextInteger();
+			speedSmoother.setTarget(state.speedKmh, millis());
+		}
 
-		state.engineCoolantTemperatureCelsius = FlowSerialReadStringUntil(';').toInt();
+		if (isParsed(StateField::COOLANT_TEMPERATURE)) {
+			state.engineCoolantTemperatureCelsius = parser.nextInteger();
+		}
 
-		state.ambientTemperatureCelsius = FlowSerialReadStringUntil(';').toInt();
+		if (isParsed(StateField::AMBIENT_TEMPERATURE)) {
+			state.ambientTemperatureCelsius = parser.nextInteger();
+		}
 
-		state.fuelLevelPercentage = FlowSerialReadStringUntil(';').toInt();
+		if (isParsed(StateField::FUEL_LEVEL)) {
+			state.fuelLevelPercentage = parser.nextInteger();
+		}
 
-		state.odometerKm = FlowSerialReadStringUntil(';').toInt() / 1000;
+		if (isParsed(StateField::ODOMETER)) {
+			uint32_t sessionOdometerKm = parser.nextInteger() / 1000;
+			if (sessionOdometerKm < lastSessionOdometerKm) {
+				// A new session started
+				state.odometerKm += sessionOdometerKm;
+				tripComputer.startNewTrip(state);
+				Persistence::requestSave();
+			} else if (sessionOdometerKnown) {
+				state.odometerKm += sessionOdometerKm - lastSessionOdometerKm;
+			}
+			sessionOdometerKnown = true;
+			lastSessionOdometerKm = sessionOdometerKm;
+		}
 
-		state.instantFuelConsumptionLP100Km = FlowSerialReadStringUntil(';').toFloat();
+		if (isParsed(StateField::INSTANT_FUEL_CONSUMPTION)) {
+			state.instantFuelConsumptionDeciLP100Km = parser.nextDeci();
+		}
 
-		state.currentTrip.averageSpeedKmh = FlowSerialReadStringUntil(';').toInt();
+		if (isParsed(StateField::GEAR)) {
+			switch (parser.nextCharacter()) {
+				case 'P':
+					state.gear = Gear::GEAR_P;
+					break;
+				case 'R':
+					state.gear = Gear::GEAR_R;
+					break;
+				case 'N':
+					state.gear = Gear::GEAR_N;
+					break;
+				case '1':
+					state.gear = Gear::GEAR_1;
+					break;
+				case '2':
+					state.gear = Gear::GEAR_2;
+					break;
+				case '3':
+					state.gear = Gear::GEAR_3;
+					break;
+				case '4':
+					state.gear = Gear::GEAR_4;
+					break;
+				case '5':
+					state.gear = Gear::GEAR_5;
+					break;
+				case '6':
+					state.gear = Gear::GEAR_6;
+					break;
+				default:
+					state.gear = Gear::GEAR_HIDDEN;
+					break;
+			}
+		}
 
-		state.currentTrip.distanceMeters = FlowSerialReadStringUntil(';').toInt();
+		if (isParsed(StateField::LEFT_INDICATOR)) {
+			state.headlights.leftIndicator = !!parser.nextInteger();
+		}
 
-		state.currentTrip.averageFuelConsumptionLP100Km = FlowSerialReadStringUntil(';').toFloat();
+		if (isParsed(StateField::RIGHT_INDICATOR)) {
+			state.headlights.rightIndicator = !!parser.nextInteger();
+		}
 
-		state.lastTrip.averageFuelConsumptionLP100Km = FlowSerialReadStringUntil(';').toFloat();
+		if (isParsed(StateField::TC_ACTIVE) && parser.nextInteger()) {
+			tcActive = true;
+			tcLastActiveMs = millis();
+		}
 
-		String gear = FlowSerialReadStringUntil(';');
-		switch (gear[0]) {
-			case 'P':
-				state.gear = Gear::GEAR_P;
-				break;
-			case 'R':
-				state.gear = Gear::GEAR_R;
-				break;
-			case 'N':
-				state.gear = Gear::GEAR_N;
-				break;
-			case '1':
-				state.gear = Gear::GEAR_1;
-				break;
-			case '2':
-				state.gear = Gear::GEAR_2;
-				break;
-			case '3':
-				state.gear = Gear::GEAR_3;
-				break;
-			case '4':
-				state.gear = Gear::GEAR_4;
-				break;
-			case '5':
-				state.gear = Gear::GEAR_5;
-				break;
-			case '6':
-				state.gear = Gear::GEAR_6;
-				break;
-			default:
-				state.gear = Gear::GEAR_HIDDEN;
+		if (isParsed(StateField::ABS_ACTIVE) && parser.nextInteger()) {
+			absActive = true;
+			absLastActiveMs = millis();
+		}
+
+		receivingMessages = true;
+		lastCommitMs = millis();
+	}
+
+	// Called when the header of a command is read, before knowing which command it is, the RPM and
+	// speed latency starts here
+	void commandHeaderReceived() {
+		messageStartUs = micros();
+	}
+
+	// Called when new data is coming from computer, only the fields the selected clusters use are sent.
+	// The data is parsed by poll() as it arrives instead of waiting for it here
+	void read() {
+		lastMessageByteMs = millis();
+		if (!parser.begin()) {
+			commit();
+			FlowSerialWrite(0x15);
+		}
+	}
+
+	// Whether a message is being received, the data coming from computer belongs to it
+	bool isReading() {
+		return parser.isActive();
+	}
+
+	// Parse the data received so far without waiting for more, to be called on every loop while
+	// isReading()
+	void poll() {
+		uint32_t currentTime = millis();
+
+		while (FlowSerialAvailable() > 0) {
+			int c = FlowSerialTimedRead();
+			if (c < 0) {
 				break;
+			}
+
+			lastMessageByteMs = currentTime;
+			if (parser.feed(c)) {
+				commit();
+#ifdef LOW_LATENCY_RPM_AND_SPEED
+				updateRpmAndSpeed(StateHolder::getState());
+#endif
+				FlowSerialWrite(0x15);
+				return;
+			}
+		}
+
+		if (currentTime - lastMessageByteMs > MESSAGE_TIMEOUT_MS) {
+			// Don't apply half a message
+			parser.abort();
+			FlowSerialDebugPrintLn("Custom protocol message timed out");
+			FlowSerialWrite(0x15);
 		}
+	}
+
+	// Move the current trip to the last trip and start a new one, like a new SimHub session does
+	void startNewTrip() {
+		tripComputer.startNewTrip(StateHolder::getState());
+		Persistence::requestSave();
+	}
+
+	void clearLastTrip() {
+		tripComputer.clearLastTrip(StateHolder::getState());
+		Persistence::requestSave();
+	}
 
-		state.headlights.leftIndicator = !!FlowSerialReadStringUntil(';').toInt();
+	// Log the time from the custom protocol command header to the RPM and speed frame, deferred frames
+	// included, and how many frames had to wait for the cluster
+	void printRpmAndSpeedLatency() {
+		String latency = String("RPM and speed latency: last ") + lastRpmAndSpeedLatencyUs
+			+ " us, max " + maxRpmAndSpeedLatencyUs
+			+ " us, " + sentRpmAndSpeedFrames + " frames sent right away, "
+			+ deferredRpmAndSpeedFrames + " deferred";
+		FlowSerialDebugPrintLn(latency);
+	}
 
-		state.headlights.rightIndicator = !!FlowSerialReadStringUntil(';').toInt();
+	// Log the SimHub custom protocol message NCalc expression for the selected clusters
+	void printNCalc() {
+		char line[96];
 
-		// TODO
-		state.tcStatus = FlowSerialReadStringUntil(';').toInt()
-			? FeatureStatus::ACTIVE
-			: FeatureStatus::ENABLED;
+		FlowSerialDebugPrintLn("''");
+		for (uint8_t field = 0; field < (uint8_t)StateField::COUNT; field++) {
+			if (!isParsed((StateField)field)) {
+				continue;
+			}
 
-		state.absStatus = FlowSerialReadStringUntil(';').toInt()
-			? FeatureStatus::ACTIVE
-			: FeatureStatus::ENABLED;
+			strncpy_P(line, getStateFieldNCalc((StateField)field), sizeof(line) - 1);
+			line[sizeof(line) - 1] = '\0';
+			FlowSerialDebugPrintLn(line);
+		}
 	}
 
 	// Called once per arduino loop, timing can't be predicted, 
 	// but it's called between each command sent to the arduino
 	void loop() {
 		State &state = StateHolder::getState();
-		Cluster::updateState(state);
+
+		uint32_t currentTime = millis();
+#ifndef LOW_LATENCY_RPM_AND_SPEED
+		state.rpm = rpmSmoother.getValue(currentTime);
+		state.speedKmh = speedSmoother.getValue(currentTime);
+#endif
+		state.tcStatus = getHeldFeatureStatus(tcActive, tcLastActiveMs, currentTime);
+		state.absStatus = getHeldFeatureStatus(absActive, absLastActiveMs, currentTime);
+		if (receivingMessages && currentTime - lastCommitMs > MESSAGE_TIMEOUT_MS) {
+			stopReceivingMessages(state, currentTime);
+		}
+		if (receivingMessages) {
+			tripComputer.update(state, currentTime, getTankCapacityLiters());
+		}
+
+		updateClusters(state);
+
+		Persistence::update(state);
+	}
+
+	// Called when SimHub stops sending data, e.g. when closing the game
+	void shutdown() {
+		stopReceivingMessages(StateHolder::getState(), millis());
+		Persistence::requestSave();
 	}
 
 	// Called once between each byte read on arduino,
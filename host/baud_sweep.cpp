@@ -0,0 +1,448 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/**
+ * Baud rate sweep of the Arduino over a serial port.
+ *
+ * Speaks the SimHub serial protocol like SimHub does, one packet at a time. For each baud rate the
+ * Arduino is switched to it with the `8` command, `X arqsink` lines are streamed between
+ * `X arqreset` and `X arqstats` for a few seconds, and the round trip of `A` commands is timed.
+ * The goodput, the NACKs and the round trip of every rate are reported, along with the fastest
+ * rate having no CRC mismatches. The Arduino is switched back to the starting rate at the end.
+ *
+ * Usage: baud_sweep <port> [seconds per rate] [starting baud rate]
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include "Crc8.h"
+
+// The smallest ARQ_MAX_PAYLOAD, the one of the boards with 2 KB of SRAM
+static constexpr uint8_t MAX_PAYLOAD = 32;
+static constexpr uint8_t MESSAGE_HEADER = 0x03;
+static constexpr uint8_t MAX_RESENDS = 10;
+static constexpr unsigned long ACK_TIMEOUT_MS = 100;
+static constexpr unsigned long REPLY_TIMEOUT_MS = 1000;
+static constexpr uint8_t ROUND_TRIPS = 10;
+static constexpr uint8_t SINK_LINE_LENGTH = 96;
+
+struct Rate {
+	// Position in baudrates in FlowSerialRead.h, starting from 1
+	uint8_t code;
+	uint32_t baudrate;
+	speed_t speed;
+};
+
+// The rates of baudrates having a termios constant, slowest first
+static const Rate rates[] = {
+	{ 7, 19200, B19200 },
+	{ 9, 38400, B38400 },
+	{ 10, 57600, B57600 },
+	{ 11, 115200, B115200 },
+	{ 12, 230400, B230400 },
+	{ 17, 500000, B500000 },
+	{ 14, 1000000, B1000000 },
+	{ 15, 2000000, B2000000 },
+};
+
+static constexpr uint8_t RATES_COUNT = sizeof(rates) / sizeof(rates[0]);
+
+struct RateResult {
+	bool measured;
+	uint32_t goodput;
+	uint32_t packets;
+	uint32_t resends;
+	uint32_t nacks[5];
+	uint32_t worstStallMs;
+	double roundTripMs;
+};
+
+static int port = -1;
+// 255 is always accepted, syncing the packet IDs with the Arduino's
+static uint8_t packetId = 255;
+static uint32_t resends = 0;
+
+static uint8_t readBuffer[256];
+static size_t readLength = 0;
+static size_t readPosition = 0;
+
+static char debugLine[256];
+static bool debugLineReceived = false;
+static bool byteReceived = false;
+
+static bool setSpeed(speed_t speed) {
+	struct termios options;
+	if (tcgetattr(port, &options) < 0) {
+		perror("tcgetattr");
+		return false;
+	}
+
+	cfmakeraw(&options);
+	options.c_cflag |= CLOCAL | CREAD;
+	options.c_cflag &= ~CRTSCTS;
+	options.c_cc[VMIN] = 0;
+	options.c_cc[VTIME] = 0;
+	cfsetispeed(&options, speed);
+	cfsetospeed(&options, speed);
+
+	if (tcsetattr(port, TCSANOW, &options) < 0) {
+		perror("tcsetattr");
+		return false;
+	}
+
+	tcflush(port, TCIOFLUSH);
+	readLength = 0;
+	readPosition = 0;
+	return true;
+}
+
+static int readByte(unsigned long deadlineMs) {
+	while (readPosition >= readLength) {
+		long remainingMs = (long)(deadlineMs - millis());
+		if (remainingMs <= 0) {
+			return -1;
+		}
+
+		struct pollfd pollFd = { port, POLLIN, 0 };
+		if (poll(&pollFd, 1, remainingMs) <= 0) {
+			continue;
+		}
+
+		ssize_t length = read(port, readBuffer, sizeof(readBuffer));
+		if (length > 0) {
+			readLength = length;
+			readPosition = 0;
+		}
+	}
+
+	return readBuffer[readPosition++];
+}
+
+static bool writeAll(const uint8_t *data, size_t length) {
+	while (length > 0) {
+		ssize_t written = write(port, data, length);
+		if (written < 0) {
+			perror("write");
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+// Read "<length> <data> 0x20", the string and debug replies
+static bool readString(char *string, unsigned long deadlineMs) {
+	int length = readByte(deadlineMs);
+	if (length < 0) {
+		return false;
+	}
+
+	for (int i = 0; i < length; i++) {
+		int c = readByte(deadlineMs);
+		if (c < 0) {
+			return false;
+		}
+		string[i] = c;
+	}
+	string[length] = '\0';
+
+	return readByte(deadlineMs) == 0x20;
+}
+
+/**
+ * Read the next reply, keeping the debug lines and the bytes written.
+ *
+ * @return The reply type, -1 on timeout, ackId holds the packet ID of ACKs and NACKs
+ */
+static int readReply(unsigned long deadlineMs, int &ackId) {
+	char string[256];
+	int type = readByte(deadlineMs);
+
+	switch (type) {
+		case 0x03:
+			ackId = readByte(deadlineMs);
+			break;
+		case 0x04:
+			ackId = readByte(deadlineMs);
+			readByte(deadlineMs);
+			break;
+		case 0x06:
+			readString(string, deadlineMs);
+			break;
+		case 0x07:
+			if (readString(debugLine, deadlineMs)) {
+				debugLineReceived = true;
+			}
+			break;
+		case 0x08:
+			readByte(deadlineMs);
+			byteReceived = true;
+			break;
+		case 0x09:
+			readByte(deadlineMs);
+			readString(string, deadlineMs);
+			break;
+		case 0x0B:
+			readByte(deadlineMs);
+			readByte(deadlineMs);
+			break;
+	}
+
+	return type;
+}
+
+// Send a packet and wait for its ACK, sending it again on NACKs and timeouts
+static bool sendPacket(const uint8_t *data, uint8_t length) {
+	uint8_t packet[4 + MAX_PAYLOAD + 1];
+	uint8_t crc = crc8Update(crc8Update(0, packetId), length);
+
+	packet[0] = 0x01;
+	packet[1] = 0x01;
+	packet[2] = packetId;
+	packet[3] = length;
+	for (uint8_t i = 0; i < length; i++) {
+		packet[4 + i] = data[i];
+		crc = crc8Update(crc, data[i]);
+	}
+	packet[4 + length] = crc;
+
+	for (uint8_t attempt = 0; attempt <= MAX_RESENDS; attempt++) {
+		if (attempt > 0) {
+			resends++;
+		}
+		if (!writeAll(packet, 5 + length)) {
+			return false;
+		}
+
+		unsigned long deadlineMs = millis() + ACK_TIMEOUT_MS;
+		int type;
+		int ackId = -1;
+		while ((type = readReply(deadlineMs, ackId)) >= 0) {
+			if (type == 0x03 && ackId == packetId) {
+				packetId = packetId >= 128 ? 0 : packetId + 1;
+				return true;
+			}
+			if (type == 0x04) {
+				break;
+			}
+		}
+	}
+
+	return false;
+}
+
+static bool sendCommand(const uint8_t *data, size_t length) {
+	while (length > 0) {
+		uint8_t packetLength = length > MAX_PAYLOAD ? MAX_PAYLOAD : length;
+		if (!sendPacket(data, packetLength)) {
+			return false;
+		}
+		data += packetLength;
+		length -= packetLength;
+	}
+	return true;
+}
+
+static bool sendExpandedCommand(const char *command) {
+	uint8_t data[MAX_PAYLOAD];
+	size_t length = strlen(command);
+
+	data[0] = MESSAGE_HEADER;
+	data[1] = 'X';
+	memcpy(&data[2], command, length);
+	data[2 + length] = '\n';
+
+	return sendCommand(data, 3 + length);
+}
+
+static bool waitFor(const bool &flag) {
+	unsigned long deadlineMs = millis() + REPLY_TIMEOUT_MS;
+	int ackId;
+	while (!flag && readReply(deadlineMs, ackId) >= 0) {
+	}
+	return flag;
+}
+
+/**
+ * Time the round trip of A commands, the Arduino replying with a byte.
+ *
+ * @return The average in milliseconds, negative if the Arduino didn't reply
+ */
+static double measureRoundTrip() {
+	static const uint8_t command[] = { MESSAGE_HEADER, 'A' };
+	unsigned long totalUs = 0;
+
+	for (uint8_t i = 0; i < ROUND_TRIPS; i++) {
+		unsigned long startUs = micros();
+		byteReceived = false;
+		if (!sendCommand(command, sizeof(command)) || !waitFor(byteReceived)) {
+			return -1;
+		}
+		totalUs += micros() - startUs;
+	}
+
+	return totalUs / 1000.0 / ROUND_TRIPS;
+}
+
+static bool switchRate(const Rate &rate) {
+	const uint8_t command[] = { MESSAGE_HEADER, '8', rate.code };
+	if (!sendCommand(command, sizeof(command))) {
+		return false;
+	}
+
+	// The Arduino waits 200 ms before switching
+	usleep(300000);
+	return setSpeed(rate.speed);
+}
+
+static bool measureRate(uint32_t durationMs, RateResult &result) {
+	uint8_t line[SINK_LINE_LENGTH];
+	static const char prefix[] = "X arqsink ";
+
+	// The command, padded up to the line length
+	line[0] = MESSAGE_HEADER;
+	memcpy(&line[1], prefix, sizeof(prefix) - 1);
+	memset(&line[sizeof(prefix)], 'x', sizeof(line) - sizeof(prefix) - 1);
+	line[sizeof(line) - 1] = '\n';
+
+	result.roundTripMs = measureRoundTrip();
+	if (result.roundTripMs < 0 || !sendExpandedCommand("arqreset")) {
+		return false;
+	}
+
+	uint32_t startResends = resends;
+	unsigned long startMs = millis();
+	while (millis() - startMs < durationMs) {
+		if (!sendCommand(line, sizeof(line))) {
+			return false;
+		}
+	}
+	result.resends = resends - startResends;
+
+	debugLineReceived = false;
+	if (!sendExpandedCommand("arqstats") || !waitFor(debugLineReceived)) {
+		return false;
+	}
+
+	const char *goodput = strchr(debugLine, '(');
+	const char *nacks = strstr(debugLine, "NACKs:");
+	const char *stall = strstr(debugLine, "worst stall ");
+	if (sscanf(debugLine, "ARQ packets %u", &result.packets) != 1
+		|| goodput == nullptr || sscanf(goodput, "(%u B/s)", &result.goodput) != 1
+		|| nacks == nullptr || sscanf(nacks, "NACKs: 1=%u 2=%u 3=%u 4=%u 5=%u",
+			&result.nacks[0], &result.nacks[1], &result.nacks[2], &result.nacks[3], &result.nacks[4]) != 5
+		|| stall == nullptr || sscanf(stall, "worst stall %u", &result.worstStallMs) != 1) {
+		fprintf(stderr, "Unexpected statistics: %s", debugLine);
+		return false;
+	}
+
+	result.measured = true;
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <port> [seconds per rate] [starting baud rate]\n", argv[0]);
+		return 1;
+	}
+
+	uint32_t durationMs = argc > 2 ? strtoul(argv[2], nullptr, 10) * 1000 : 5000;
+	uint32_t startBaudrate = argc > 3 ? strtoul(argv[3], nullptr, 10) : 19200;
+
+	const Rate *startRate = nullptr;
+	for (const Rate &rate : rates) {
+		if (rate.baudrate == startBaudrate) {
+			startRate = &rate;
+		}
+	}
+	if (startRate == nullptr) {
+		fprintf(stderr, "Unsupported starting baud rate %u\n", (unsigned)startBaudrate);
+		return 1;
+	}
+
+	port = open(argv[1], O_RDWR | O_NOCTTY);
+	if (port < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (!setSpeed(startRate->speed)) {
+		return 1;
+	}
+
+	// Boards resetting when the port opens need to boot first
+	sleep(2);
+
+	RateResult results[RATES_COUNT] = {};
+	const Rate *currentRate = startRate;
+	bool connected = true;
+
+	for (uint8_t i = 0; i < RATES_COUNT && connected; i++) {
+		printf("%u...\n", (unsigned)rates[i].baudrate);
+		fflush(stdout);
+
+		if (&rates[i] != currentRate && !switchRate(rates[i])) {
+			connected = false;
+			break;
+		}
+		currentRate = &rates[i];
+
+		if (!measureRate(durationMs, results[i])) {
+			// Going back may still work, if only the fast stream failed
+			connected = switchRate(*startRate);
+			currentRate = startRate;
+		}
+	}
+
+	if (connected && currentRate != startRate) {
+		connected = switchRate(*startRate);
+	}
+
+	printf("   baud  goodput B/s  packets  resends  CRC NACKs  other NACKs  stall ms  round trip ms\n");
+	const Rate *bestRate = nullptr;
+	uint32_t bestGoodput = 0;
+	for (uint8_t i = 0; i < RATES_COUNT; i++) {
+		const RateResult &result = results[i];
+		if (!result.measured) {
+			printf("%7u            -        -        -          -            -         -              -\n",
+				(unsigned)rates[i].baudrate);
+			continue;
+		}
+
+		uint32_t otherNacks = result.nacks[0] + result.nacks[1] + result.nacks[2] + result.nacks[4];
+		printf("%7u %12u %8u %8u %10u %12u %9u %14.2f\n",
+			(unsigned)rates[i].baudrate,
+			(unsigned)result.goodput,
+			(unsigned)result.packets,
+			(unsigned)result.resends,
+			(unsigned)result.nacks[3],
+			(unsigned)otherNacks,
+			(unsigned)result.worstStallMs,
+			result.roundTripMs);
+
+		if (result.nacks[3] == 0 && result.goodput > bestGoodput) {
+			bestRate = &rates[i];
+			bestGoodput = result.goodput;
+		}
+	}
+
+	if (bestRate != nullptr) {
+		printf("Best: %u\n", (unsigned)bestRate->baudrate);
+	}
+	if (!connected) {
+		fprintf(stderr, "Lost the Arduino, reset it before connecting again\n");
+	}
+
+	close(port);
+
+	return connected && bestRate != nullptr ? 0 : 1;
+}
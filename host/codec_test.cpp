@@ -0,0 +1,319 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/**
+ * Round-trip tests of the cluster commands.
+ *
+ * Random states are encoded by each cluster, the frames are decoded back into a new state with the
+ * cluster's decodeFrame(), and the new state must encode to the very same frames. This holds for
+ * lossy fields too (e.g. the coolant temperature bands), as long as the decoders pick a value the
+ * encoders map to the same bytes. Some fields are checked against the original values as well.
+ *
+ * Usage: codec_test [states]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The cluster code relies on the sketch including it first
+#include <Arduino.h>
+#include "BlinkClock.h"
+#include "CanBus.h"
+#include "clusters/citroen_c5_ii/Cluster.h"
+#include "clusters/peugeot_208_i/Cluster.h"
+#include "clusters/peugeot_3008_i/Cluster.h"
+#include "clusters/peugeot_multifunction_display/Cluster.h"
+
+/**
+ * Bus keeping the frames sent, in order.
+ */
+class CaptureCanBus : public CanBus {
+public:
+	static constexpr uint8_t MAX_FRAMES = 32;
+
+	void setup(uint32_t bitrate) override {
+		(void)bitrate;
+	}
+
+	bool sendMessage(const struct can_frame *frame) override {
+		if (count >= MAX_FRAMES) {
+			return false;
+		}
+		frames[count++] = *frame;
+		return true;
+	}
+
+	void setReceiveFilters(const canid_t *ids, uint8_t count) override {
+		(void)ids;
+		(void)count;
+	}
+
+	void receiveAllMessages() override {}
+
+	bool readMessage(struct can_frame *frame) override {
+		(void)frame;
+		return false;
+	}
+
+	struct can_frame frames[MAX_FRAMES];
+	uint8_t count = 0;
+};
+
+typedef bool (*DecodeFrame)(const struct can_frame &frame, State &state);
+
+static uint32_t seed = 0x12345678;
+static uint32_t failures = 0;
+
+// xorshift32, the same sequence on every run
+static uint32_t randomNumber() {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static int32_t randomRange(int32_t min, int32_t max) {
+	return min + (int32_t)(randomNumber() % (uint32_t)(max - min + 1));
+}
+
+static bool randomBool() {
+	return randomNumber() & 1;
+}
+
+template <typename E>
+static E randomEnum(uint8_t count) {
+	return (E)(randomNumber() % count);
+}
+
+static void randomTrip(Trip &trip) {
+	trip.averageSpeedKmh = randomRange(0, 255);
+	trip.distanceMeters = randomRange(0, 9999999);
+	trip.averageFuelConsumptionDeciLP100Km = randomRange(0, 999);
+	trip.durationMinutes = randomRange(0, 9999);
+}
+
+static State randomClusterState() {
+	State state;
+
+	state.locale.timeDisplayMode = randomEnum<TimeDisplayMode>(2);
+	state.locale.temperatureUnit = randomEnum<TemperatureUnit>(3);
+	state.locale.pressureUnit = randomEnum<PressureUnit>(3);
+	state.locale.consumptionUnit = randomEnum<ConsumptionUnit>(2);
+	state.locale.volumeUnit = randomEnum<VolumeUnit>(2);
+	state.locale.distanceUnit = randomEnum<DistanceUnit>(2);
+	state.locale.language = randomEnum<Language>(14);
+
+	state.ignitionState = randomEnum<IgnitionState>(3);
+	state.engineStarted = randomBool();
+	state.economyModeEnabled = randomBool();
+	state.dashboardLightingEnabled = randomBool();
+	state.darkModeEnabled = randomBool();
+	state.dashboardBrightness = randomRange(0, 0x0F);
+
+	state.rpm = randomRange(0, 8000);
+	state.speedKmh = randomRange(0, 300);
+	state.engineCoolantTemperatureCelsius = randomRange(-30, 150);
+	state.engineOilTemperatureCelsius = randomRange(-30, 150);
+	state.ambientTemperatureCelsius = randomRange(-40, 60);
+	state.fuelLevelPercentage = randomRange(0, 100);
+	state.odometerKm = randomRange(0, 999999);
+	state.instantFuelConsumptionDeciLP100Km = randomRange(0, 999);
+	state.remainingFuelDistanceKm = randomRange(0, 2000);
+
+	randomTrip(state.currentTrip);
+	randomTrip(state.lastTrip);
+
+	state.carServiceStatus = randomEnum<CarServiceStatus>(3);
+	state.serviceCounterKm = randomRange(0, 30000);
+
+	state.gear = randomEnum<Gear>(17);
+	state.blinkingGear = randomBool();
+	state.autoGearSelection = randomBool();
+	state.sportMode = randomBool();
+
+	state.headlights.sidelights = randomBool();
+	state.headlights.lowBeam = randomBool();
+	state.headlights.highBeam = randomBool();
+	state.headlights.frontFogLights = randomBool();
+	state.headlights.rearFogLights = randomBool();
+	state.headlights.leftIndicator = randomBool();
+	state.headlights.rightIndicator = randomBool();
+
+	state.checkEngineLightStatus = randomEnum<LightStatus>(3);
+	state.engineFault = randomEnum<EngineFault>(3);
+	state.parkingBrakeLightStatus = randomEnum<LightStatus>(3);
+	state.engineOilLevel = randomEnum<EngineOilLevel>(3);
+	state.highEngineCoolantTemperatureLightStatus = randomEnum<LightStatus>(3);
+	state.batteryNotChargingLightStatus = randomEnum<LightStatus>(3);
+	state.startAndStopLightStatus = randomEnum<LightStatus>(3);
+	state.powerSteeringWarning = randomBool();
+	state.airbagWarning = randomBool();
+	state.lowBeamWarning = randomBool();
+	state.waterInFuelFilterWarning = randomBool();
+	state.automaticParkingBrakeIssue = randomBool();
+	state.sportAndWinterGearBlink = randomBool();
+	state.stopWarning = randomBool();
+	state.serviceWarning = randomBool();
+	state.anyDoorOpen = randomBool();
+	state.lowFuel = randomBool();
+	state.engineOilPressureWarning = randomBool();
+
+	state.dieselGlowPlugsLight = randomBool();
+	state.pressBrakePedalLightStatus = randomEnum<LightStatus>(3);
+	state.parkAssistLightStatus = randomEnum<LightStatus>(3);
+	state.secondPassengerAirbagDisabled = randomBool();
+	state.pressClutchLightStatus = randomEnum<LightStatus>(3);
+	state.automaticParkingBrakeDisabled = randomBool();
+	state.automaticWipersEnabled = randomBool();
+
+	state.driverSeatBeltsStatus = randomEnum<LightStatus>(3);
+	state.passengerSeatBeltsStatus = randomEnum<LightStatus>(3);
+	state.rearLeftSeatBeltsStatus = randomEnum<LightStatus>(3);
+	state.rearCenterSeatBeltsStatus = randomEnum<LightStatus>(3);
+	state.rearRightSeatBeltsStatus = randomEnum<LightStatus>(3);
+
+	state.tcStatus = randomEnum<FeatureStatus>(3);
+	state.absStatus = randomEnum<FeatureStatus>(3);
+
+	return state;
+}
+
+// A new cluster every time, its debouncers let every frame through
+template <typename C>
+static void encode(State state, CaptureCanBus &canBus) {
+	C cluster(canBus);
+	cluster.updateState(state);
+}
+
+static void printFrame(const char *prefix, const struct can_frame &frame) {
+	printf("  %s %03X [%u]", prefix, (unsigned)frame.can_id, (unsigned)frame.can_dlc);
+	for (uint8_t i = 0; i < frame.can_dlc; i++) {
+		printf(" %02X", frame.data[i]);
+	}
+	printf("\n");
+}
+
+static bool sameFrame(const struct can_frame &a, const struct can_frame &b) {
+	return a.can_id == b.can_id
+		&& a.can_dlc == b.can_dlc
+		&& memcmp(a.data, b.data, a.can_dlc) == 0;
+}
+
+// Frames carrying no state, sent as is
+static bool isConstantFrame(canid_t canId) {
+	return canId == 0x1A1;
+}
+
+/**
+ * Encode the state, decode it back and encode the decoded state again.
+ *
+ * @return Whether both encodings match, decoded is filled with the decoded state
+ */
+template <typename C>
+static bool roundTrip(const char *name, DecodeFrame decodeFrame, const State &state, State &decoded) {
+	CaptureCanBus original;
+	CaptureCanBus reencoded;
+	bool blinkPhase;
+
+	// The blinking lights must be encoded twice with the same phase
+	do {
+		blinkPhase = BlinkClock::isOn(BlinkRate::FAST);
+
+		original.count = 0;
+		encode<C>(state, original);
+
+		decoded = State();
+		for (uint8_t i = 0; i < original.count; i++) {
+			if (!decodeFrame(original.frames[i], decoded) && !isConstantFrame(original.frames[i].can_id)) {
+				printf("%s: frame %03X not decoded\n", name, (unsigned)original.frames[i].can_id);
+				return false;
+			}
+		}
+
+		reencoded.count = 0;
+		encode<C>(decoded, reencoded);
+	} while (blinkPhase != BlinkClock::isOn(BlinkRate::FAST));
+
+	if (original.count != reencoded.count) {
+		printf("%s: %u frames encoded, %u after decoding\n", name, original.count, reencoded.count);
+		return false;
+	}
+
+	for (uint8_t i = 0; i < original.count; i++) {
+		if (!sameFrame(original.frames[i], reencoded.frames[i])) {
+			printf("%s: frame %03X doesn't round-trip\n", name, (unsigned)original.frames[i].can_id);
+			printFrame("encoded ", original.frames[i]);
+			printFrame("reencoded", reencoded.frames[i]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void check(const char *name, const char *field, int32_t expected, int32_t actual, int32_t tolerance) {
+	if (actual < expected - tolerance || actual > expected + tolerance) {
+		printf("%s: %s %d decoded as %d\n", name, field, (int)expected, (int)actual);
+		failures++;
+	}
+}
+
+/**
+ * @param coolantTolerance How far from the original the decoded coolant temperature can be
+ */
+template <typename C>
+static void testCluster(const char *name, DecodeFrame decodeFrame, uint32_t statesCount, int32_t coolantTolerance) {
+	uint32_t clusterFailures = failures;
+
+	for (uint32_t i = 0; i < statesCount; i++) {
+		State state = randomClusterState();
+		State decoded;
+
+		if (!roundTrip<C>(name, decodeFrame, state, decoded)) {
+			failures++;
+			continue;
+		}
+
+		// The multifunction display only uses the speed for the trip computer
+		if (C::CONSUMED_FIELDS & stateFieldBit(StateField::RPM)) {
+			check(name, "RPM", state.rpm, decoded.rpm, 0);
+			check(name, "speed", state.speedKmh, decoded.speedKmh, 0);
+		}
+		if (C::CONSUMED_FIELDS & stateFieldBit(StateField::ODOMETER)) {
+			check(name, "odometer", state.odometerKm, decoded.odometerKm, 0);
+		}
+		if (C::CONSUMED_FIELDS & stateFieldBit(StateField::AMBIENT_TEMPERATURE)) {
+			check(name, "ambient temperature", state.ambientTemperatureCelsius, decoded.ambientTemperatureCelsius, 1);
+		}
+	}
+
+	// Every coolant temperature the cluster shows, through all the bands
+	for (int32_t coolant = -30; coolant <= 130; coolant++) {
+		State state;
+		State decoded;
+
+		state.engineCoolantTemperatureCelsius = coolant;
+		if (!roundTrip<C>(name, decodeFrame, state, decoded)) {
+			failures++;
+			continue;
+		}
+
+		check(name, "coolant temperature", coolant, decoded.engineCoolantTemperatureCelsius, coolantTolerance);
+	}
+
+	printf("%s: %s\n", name, failures == clusterFailures ? "OK" : "FAILED");
+}
+
+int main(int argc, char **argv) {
+	uint32_t statesCount = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+
+	testCluster<CitroenC5IICluster>("c5", citroen_c5_ii::decodeFrame, statesCount, 6);
+	testCluster<Peugeot208ICluster>("208", peugeot_208_i::decodeFrame, statesCount, 6);
+	testCluster<Peugeot3008ICluster>("3008", peugeot_3008_i::decodeFrame, statesCount, 0);
+	testCluster<PeugeotMultifunctionDisplayCluster>("mfd", peugeot_multifunction_display::decodeFrame, statesCount, 6);
+
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/**
+ * Benchmark of the CRC-8 implementations on the host.
+ *
+ * Checks that the three implementations agree for every CRC and byte, then times each one over the
+ * same data, like "X crcbench" does on the device. Host timings only rank the implementations on
+ * this CPU, the AVR ones come from the device.
+ *
+ * Usage: crc8_benchmark [KB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "Crc8.h"
+
+typedef uint8_t (*Crc8Update)(uint8_t crc, uint8_t value);
+
+static uint8_t data[1024];
+static volatile uint8_t sink;
+
+static uint64_t nanoseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+template <Crc8Update update>
+static double benchmarkMicrosPerKb(uint32_t kilobytes) {
+	uint8_t crc = 0;
+	uint64_t start = nanoseconds();
+	for (uint32_t i = 0; i < kilobytes; i++) {
+		for (uint16_t j = 0; j < sizeof(data); j++) {
+			crc = update(crc, data[j]);
+		}
+	}
+	uint64_t elapsed = nanoseconds() - start;
+	sink = crc;
+	return elapsed / 1000.0 / kilobytes;
+}
+
+int main(int argc, char **argv) {
+	uint32_t kilobytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+	uint32_t mismatches = 0;
+
+	for (uint16_t crc = 0; crc < 256; crc++) {
+		for (uint16_t value = 0; value < 256; value++) {
+			uint8_t expected = crc8UpdateBitwise(crc, value);
+			if (crc8UpdateProgmemTable(crc, value) != expected || crc8UpdateNibbleTables(crc, value) != expected) {
+				printf("CRC %02X byte %02X: implementations differ\n", crc, value);
+				mismatches++;
+			}
+		}
+	}
+
+	// xorshift32, the same data on every run
+	uint32_t seed = 0x12345678;
+	for (uint8_t &byte : data) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		byte = seed;
+	}
+
+	printf("CRC-8 us/KB: PROGMEM table %.2f, nibble tables %.2f, bitwise %.2f\n",
+		benchmarkMicrosPerKb<crc8UpdateProgmemTable>(kilobytes),
+		benchmarkMicrosPerKb<crc8UpdateNibbleTables>(kilobytes),
+		benchmarkMicrosPerKb<crc8UpdateBitwise>(kilobytes));
+
+	return mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/**
+ * Decoder of the CanFuzzer binary log.
+ *
+ * Reads the bytes captured from the serial port with "log on" (e.g. with
+ * `stty -F /dev/ttyACM0 115200 raw && cat /dev/ttyACM0 > fuzz.log`), looks for LOG_SYNC followed by
+ * a valid length and a matching CRC, and prints every record, the responses under the fuzzed frame
+ * they belong to. Bytes not part of a valid record (text printed before the log was enabled, or
+ * corrupted records) are skipped and counted, as well as the records whose CRC doesn't match. The
+ * report at the end lists the fuzzed frames having responses.
+ *
+ * Usage: fuzz_log [file], reading from stdin without a file
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+// The fuzzer code relies on the sketch including it first
+#include <Arduino.h>
+#include "CanFuzzer.h"
+#include "Crc8.h"
+
+/**
+ * Fields from the type to the DLC, before the payload.
+ */
+static constexpr uint8_t HEADER_SIZE = 8;
+
+/**
+ * Sync, length, header, payload and CRC of the longest record.
+ */
+static constexpr uint8_t MAX_RECORD_SIZE = 2 + HEADER_SIZE + CAN_MAX_DLEN + 1;
+
+static constexpr uint16_t MAX_RESPONSIVE_FRAMES = 256;
+
+struct Record {
+	uint8_t type;
+	uint32_t timestampMs;
+	struct can_frame frame;
+};
+
+struct ResponsiveFrame {
+	struct can_frame frame;
+	uint32_t responses;
+};
+
+/**
+ * Decode the record at the start of the buffer.
+ *
+ * @param buffer The bytes, starting with LOG_SYNC
+ * @param length The number of bytes in the buffer
+ * @param record The record to be filled
+ * @param badCrc Set when the buffer starts with a valid header but the CRC doesn't match
+ * @return The size of the record, 0 if the buffer doesn't start with a valid one
+ */
+static uint8_t decodeRecord(const uint8_t *buffer, uint8_t length, Record &record, bool &badCrc) {
+	badCrc = false;
+	if (length < 2 || buffer[0] != CanFuzzer::LOG_SYNC) {
+		return 0;
+	}
+
+	uint8_t fieldsLength = buffer[1];
+	if (fieldsLength < HEADER_SIZE || fieldsLength > HEADER_SIZE + CAN_MAX_DLEN
+			|| length < 2 + fieldsLength + 1) {
+		return 0;
+	}
+
+	const uint8_t *fields = &buffer[2];
+	uint8_t dlc = fields[7];
+	if (fieldsLength != HEADER_SIZE + dlc
+			|| (fields[0] != CanFuzzer::LOG_FUZZED_FRAME && fields[0] != CanFuzzer::LOG_RESPONSE_FRAME)) {
+		return 0;
+	}
+
+	uint8_t crc = 0;
+	for (uint8_t i = 0; i < fieldsLength; i++) {
+		crc = crc8Update(crc, fields[i]);
+	}
+	if (crc != fields[fieldsLength]) {
+		badCrc = true;
+		return 0;
+	}
+
+	record.type = fields[0];
+	record.timestampMs = fields[1] | (uint32_t)fields[2] << 8 | (uint32_t)fields[3] << 16 | (uint32_t)fields[4] << 24;
+	record.frame.can_id = fields[5] | (canid_t)fields[6] << 8;
+	record.frame.can_dlc = dlc;
+	memcpy(record.frame.data, &fields[HEADER_SIZE], dlc);
+
+	return 2 + fieldsLength + 1;
+}
+
+static void printFrame(const struct can_frame &frame) {
+	printf("%03X [%u]", frame.can_id, frame.can_dlc);
+	for (uint8_t i = 0; i < frame.can_dlc; i++) {
+		printf(" %02X", frame.data[i]);
+	}
+}
+
+int main(int argc, char **argv) {
+	FILE *file = argc > 1 ? fopen(argv[1], "rb") : stdin;
+	if (file == nullptr) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	uint8_t buffer[MAX_RECORD_SIZE];
+	uint8_t length = 0;
+	bool endOfFile = false;
+
+	uint32_t fuzzedFrames = 0;
+	uint32_t responses = 0;
+	uint32_t orphanResponses = 0;
+	uint32_t skippedBytes = 0;
+	uint32_t badCrcs = 0;
+
+	static ResponsiveFrame responsiveFrames[MAX_RESPONSIVE_FRAMES];
+	uint16_t responsiveFramesCount = 0;
+	ResponsiveFrame *lastFuzzedFrame = nullptr;
+	struct can_frame lastFrame;
+	bool hasLastFrame = false;
+
+	while (!endOfFile || length > 0) {
+		while (!endOfFile && length < sizeof(buffer)) {
+			int c = fgetc(file);
+			if (c == EOF) {
+				endOfFile = true;
+				break;
+			}
+			buffer[length++] = c;
+		}
+
+		Record record;
+		bool badCrc;
+		uint8_t recordSize = decodeRecord(buffer, length, record, badCrc);
+		if (badCrc) {
+			badCrcs++;
+		}
+		if (recordSize == 0) {
+			// Not a record, resync from the next byte
+			skippedBytes++;
+			memmove(buffer, &buffer[1], --length);
+			continue;
+		}
+		memmove(buffer, &buffer[recordSize], length - recordSize);
+		length -= recordSize;
+
+		if (record.type == CanFuzzer::LOG_FUZZED_FRAME) {
+			fuzzedFrames++;
+			lastFrame = record.frame;
+			hasLastFrame = true;
+			lastFuzzedFrame = nullptr;
+
+			printf("%10.3f F ", record.timestampMs / 1000.0);
+			printFrame(record.frame);
+			printf("\n");
+			continue;
+		}
+
+		responses++;
+		printf("%10.3f   R ", record.timestampMs / 1000.0);
+		printFrame(record.frame);
+		printf("\n");
+
+		if (!hasLastFrame) {
+			orphanResponses++;
+			continue;
+		}
+
+		if (lastFuzzedFrame == nullptr && responsiveFramesCount < MAX_RESPONSIVE_FRAMES) {
+			lastFuzzedFrame = &responsiveFrames[responsiveFramesCount++];
+			lastFuzzedFrame->frame = lastFrame;
+			lastFuzzedFrame->responses = 0;
+		}
+		if (lastFuzzedFrame != nullptr) {
+			lastFuzzedFrame->responses++;
+		}
+	}
+
+	if (file != stdin) {
+		fclose(file);
+	}
+
+	printf("\n%u fuzzed frames, %u responses (%u before any fuzzed frame)\n",
+		fuzzedFrames, responses, orphanResponses);
+	printf("%u bytes skipped, %u records with a bad CRC\n", skippedBytes, badCrcs);
+
+	if (responsiveFramesCount > 0) {
+		printf("Fuzzed frames followed by responses:\n");
+		for (uint16_t i = 0; i < responsiveFramesCount; i++) {
+			printf("  ");
+			printFrame(responsiveFrames[i].frame);
+			printf(": %u\n", responsiveFrames[i].responses);
+		}
+		if (responsiveFramesCount == MAX_RESPONSIVE_FRAMES) {
+			printf("  (only the first %u are listed)\n", MAX_RESPONSIVE_FRAMES);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+/**
+ * The bits of the Arduino API the cluster code uses, to build it on Linux.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <avr/pgmspace.h>
+
+// Only declared, host builds don't print through the Arduino String
+class String;
+
+static inline unsigned long millis() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static inline unsigned long micros() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
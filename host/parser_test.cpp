@@ -0,0 +1,87 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/**
+ * Tests of the SimHub custom protocol message parser.
+ *
+ * Usage: parser_test
+ */
+
+#include <stdio.h>
+
+// The parser relies on the sketch including it first
+#include <Arduino.h>
+#include "MessageParser.h"
+
+static constexpr StateFieldMask FIELDS = LOCALE_FIELDS
+	| stateFieldBit(StateField::RPM)
+	| stateFieldBit(StateField::COOLANT_TEMPERATURE)
+	| stateFieldBit(StateField::INSTANT_FUEL_CONSUMPTION)
+	| stateFieldBit(StateField::GEAR);
+
+static uint32_t failures = 0;
+
+struct Message {
+	const char *text;
+	int8_t temperatureUnit;
+	int8_t pressureUnit;
+	int8_t volumeUnit;
+	int8_t speedUnit;
+	int32_t rpm;
+	int32_t coolantTemperature;
+	uint16_t instantFuelConsumption;
+	char gear;
+};
+
+static const Message messages[] = {
+	{ "Celcius;Bar;Liters;KMH;3500;90;7.46;3;", 0, 0, 0, 0, 3500, 90, 75, '3' },
+	{ "Fahrenheit;Psi;Gallons;MPH;0;-12;12,04;R;", 1, 2, 1, 1, 0, -12, 120, 'R' },
+	{ "Kelvin;Kpa;Liters;KMH; 800x;;-1;;", 2, 1, 0, 0, 800, 0, 0, '\0' },
+	// Prefixes and extensions of known units
+	{ "Celciu;Bars;Liter;KM;1;2;3;N;", -1, -1, -1, -1, 1, 2, 30, 'N' },
+	// Same hashes as Kelvin and MPH
+	{ "tmj;;Liters;aqrw;1;2;3;N;", -1, -1, 0, -1, 1, 2, 30, 'N' },
+};
+
+static void check(const char *text, const char *field, int32_t expected, int32_t actual) {
+	if (expected != actual) {
+		printf("\"%s\": %s %d parsed as %d\n", text, field, (int)expected, (int)actual);
+		failures++;
+	}
+}
+
+int main() {
+	MessageParser<FIELDS> parser;
+
+	for (const Message &message : messages) {
+		bool complete = false;
+
+		parser.begin();
+		for (const char *c = message.text; *c != '\0'; c++) {
+			if (parser.feed(*c)) {
+				complete = c[1] == '\0';
+			}
+		}
+
+		if (!complete) {
+			printf("\"%s\": not complete\n", message.text);
+			failures++;
+			continue;
+		}
+
+		check(message.text, "temperature unit", message.temperatureUnit, parser.nextToken());
+		check(message.text, "pressure unit", message.pressureUnit, parser.nextToken());
+		check(message.text, "volume unit", message.volumeUnit, parser.nextToken());
+		check(message.text, "speed unit", message.speedUnit, parser.nextToken());
+		check(message.text, "RPM", message.rpm, parser.nextInteger());
+		check(message.text, "coolant temperature", message.coolantTemperature, parser.nextInteger());
+		check(message.text, "instant fuel consumption", message.instantFuelConsumption, parser.nextDeci());
+		check(message.text, "gear", message.gear, parser.nextCharacter());
+	}
+
+	printf("parser: %s\n", failures == 0 ? "OK" : "FAILED");
+
+	return failures > 0 ? 1 : 0;
+}
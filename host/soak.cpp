@@ -0,0 +1,178 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/**
+ * Soak test of a cluster over SocketCAN.
+ *
+ * Runs the cluster's updateState() in a loop with gauges sweeping through their range, the frames
+ * going to a real interface (e.g. vcan0) where candump or Wireshark can follow them. The frames are
+ * read back with their kernel timestamps, and the interval between two frames of the same ID is
+ * reported at the end, to spot scheduling jitter.
+ *
+ * Usage: soak <interface> <c5|208|3008|mfd> [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The cluster code relies on the sketch including it first
+#include <Arduino.h>
+#include "SocketCanBus.h"
+#include "StateHolder.h"
+#include "clusters/citroen_c5_ii/Cluster.h"
+#include "clusters/peugeot_208_i/Cluster.h"
+#include "clusters/peugeot_3008_i/Cluster.h"
+#include "clusters/peugeot_multifunction_display/Cluster.h"
+
+static constexpr uint8_t MAX_IDS = 64;
+
+struct IdStats {
+	canid_t id;
+	uint32_t frames;
+	int64_t lastUs;
+	int64_t minIntervalUs;
+	int64_t maxIntervalUs;
+	int64_t totalIntervalUs;
+};
+
+static IdStats idStats[MAX_IDS];
+static uint8_t idStatsCount = 0;
+static uint32_t otherFrames = 0;
+
+static void recordFrame(canid_t id, const struct timeval &timestamp) {
+	int64_t timeUs = (int64_t)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+
+	IdStats *stats = nullptr;
+	for (uint8_t i = 0; i < idStatsCount; i++) {
+		if (idStats[i].id == id) {
+			stats = &idStats[i];
+			break;
+		}
+	}
+
+	if (stats == nullptr) {
+		if (idStatsCount >= MAX_IDS) {
+			return;
+		}
+		stats = &idStats[idStatsCount++];
+		*stats = { id, 0, 0, INT64_MAX, 0, 0 };
+	}
+
+	if (stats->frames > 0) {
+		int64_t intervalUs = timeUs - stats->lastUs;
+		if (intervalUs < stats->minIntervalUs) {
+			stats->minIntervalUs = intervalUs;
+		}
+		if (intervalUs > stats->maxIntervalUs) {
+			stats->maxIntervalUs = intervalUs;
+		}
+		stats->totalIntervalUs += intervalUs;
+	}
+
+	stats->frames++;
+	stats->lastUs = timeUs;
+}
+
+// Gauges sweep back and forth, the indicators follow the turn signals
+static void updateState(State &state, uint32_t timeMs) {
+	uint32_t phase = timeMs % 8000;
+	uint32_t ramp = phase < 4000 ? phase : 8000 - phase;
+
+	state.ignitionState = IgnitionState::ON;
+	state.engineStarted = true;
+	state.dashboardLightingEnabled = true;
+	state.dashboardBrightness = 0x0F;
+	state.rpm = 800 + ramp * 6200 / 4000;
+	state.speedKmh = ramp * 200 / 4000;
+	state.engineCoolantTemperatureCelsius = 40 + ramp * 80 / 4000;
+	state.ambientTemperatureCelsius = 20;
+	state.fuelLevelPercentage = 100 - ramp * 100 / 4000;
+	state.instantFuelConsumptionDeciLP100Km = 50 + ramp * 150 / 4000;
+	state.gear = Gear::GEAR_3;
+	state.headlights.leftIndicator = (timeMs / 4000) % 2 == 0;
+	state.headlights.rightIndicator = !state.headlights.leftIndicator;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <interface> <c5|208|3008|mfd> [seconds]\n", argv[0]);
+		return 1;
+	}
+
+	SocketCanBus canBus(argv[1]);
+
+	CitroenC5IICluster citroenC5IICluster(canBus);
+	Peugeot208ICluster peugeot208ICluster(canBus);
+	Peugeot3008ICluster peugeot3008ICluster(canBus);
+	PeugeotMultifunctionDisplayCluster peugeotMultifunctionDisplayCluster(canBus);
+
+	Cluster *cluster;
+	if (strcmp(argv[2], "c5") == 0) {
+		cluster = &citroenC5IICluster;
+	} else if (strcmp(argv[2], "208") == 0) {
+		cluster = &peugeot208ICluster;
+	} else if (strcmp(argv[2], "3008") == 0) {
+		cluster = &peugeot3008ICluster;
+	} else if (strcmp(argv[2], "mfd") == 0) {
+		cluster = &peugeotMultifunctionDisplayCluster;
+	} else {
+		fprintf(stderr, "Unknown cluster %s\n", argv[2]);
+		return 1;
+	}
+
+	uint32_t durationMs = argc > 3 ? strtoul(argv[3], nullptr, 10) * 1000 : 10000;
+
+	cluster->setup();
+	if (!canBus.isOpen()) {
+		return 1;
+	}
+
+	// Every frame, including the ones sent by the cluster, with kernel timestamps
+	canBus.receiveAllMessages();
+	canBus.setReceiveOwnMessages(true);
+
+	State &state = StateHolder::getState();
+	uint32_t startMs = millis();
+	uint32_t timeMs;
+
+	while ((timeMs = millis() - startMs) < durationMs) {
+		updateState(state, timeMs);
+		cluster->updateState(state);
+
+		struct can_frame frame;
+		while (canBus.readMessage(&frame)) {
+			if (canBus.isLastMessageOwn()) {
+				recordFrame(frame.can_id & CAN_SFF_MASK, canBus.getLastTimestamp());
+			} else {
+				otherFrames++;
+			}
+		}
+
+		// The sketch loop takes about a millisecond too
+		struct timespec delay = { 0, 1000000 };
+		nanosleep(&delay, nullptr);
+	}
+
+	printf("ID     frames  mean ms   min ms   max ms\n");
+	for (uint8_t i = 0; i < idStatsCount; i++) {
+		const IdStats &stats = idStats[i];
+		if (stats.frames < 2) {
+			printf("0x%03X %7u        -        -        -\n", (unsigned)stats.id, (unsigned)stats.frames);
+			continue;
+		}
+
+		printf("0x%03X %7u %8.2f %8.2f %8.2f\n",
+			(unsigned)stats.id,
+			(unsigned)stats.frames,
+			stats.totalIntervalUs / 1000.0 / (stats.frames - 1),
+			stats.minIntervalUs / 1000.0,
+			stats.maxIntervalUs / 1000.0);
+	}
+	printf("%u frames from other nodes\n", (unsigned)otherFrames);
+
+	return idStatsCount > 0 ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "BlinkClock.h"
+
+#include <Arduino.h>
+
+uint16_t BlinkClock::getPhase(BlinkRate rate) {
+	uint16_t halfPeriodMs = rate == BlinkRate::FAST ? 250 : 500;
+
+	return millis() / halfPeriodMs;
+}
+
+bool BlinkClock::isOn(BlinkRate rate) {
+	return getPhase(rate) % 2 == 0;
+}
+
+bool BlinkClock::isLit(LightStatus status, BlinkRate rate) {
+	switch (status) {
+		case LightStatus::ON:
+			return true;
+		case LightStatus::BLINKING:
+			return isOn(rate);
+		case LightStatus::OFF:
+		default:
+			return false;
+	}
+}
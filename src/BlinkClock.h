@@ -0,0 +1,37 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "types.h"
+
+enum class BlinkRate {
+	SLOW = 0, // 1 Hz
+	FAST = 1, // 2 Hz
+};
+
+/**
+ * Shared blink phases, for lights the cluster can't blink by itself.
+ *
+ * Every phase comes from the same clock, so all the lights blinking at the same rate are lit
+ * together, and the fast phase toggles along with the slow one.
+ */
+class BlinkClock {
+public:
+	/**
+	 * @return The number of the current blink half-period, changing whenever isOn() does
+	 */
+	static uint16_t getPhase(BlinkRate rate = BlinkRate::SLOW);
+
+	/**
+	 * @return Whether the blinking lights are currently lit
+	 */
+	static bool isOn(BlinkRate rate = BlinkRate::SLOW);
+
+	/**
+	 * @return Whether a light with the given status is currently lit
+	 */
+	static bool isLit(LightStatus status, BlinkRate rate = BlinkRate::SLOW);
+};
@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Linux builds outside of the Arduino IDE use SocketCAN, which the MCP2515 library mirrors the frame
+// definitions of
+#if defined(__linux__) && !defined(ARDUINO)
+#include <linux/can.h>
+#else
+#include <mcp2515.h>
+#endif
+
+/**
+ * CAN transport a cluster sends its frames through and receives its frames from.
+ */
+class CanBus {
+public:
+	/**
+	 * Initialize the bus and join it.
+	 *
+	 * @param bitrate The bus bitrate in bits per second
+	 */
+	virtual void setup(uint32_t bitrate) = 0;
+
+	/**
+	 * Send a frame.
+	 *
+	 * @param frame The frame to be sent
+	 * @return true if the frame has been queued for transmission, false otherwise
+	 */
+	virtual bool sendMessage(const struct can_frame *frame) = 0;
+
+	/**
+	 * Only accept the given standard IDs from now on, filtering out everything else as early as
+	 * the transport allows. By default no standard frame is accepted.
+	 *
+	 * @param ids The IDs to accept, duplicates are allowed
+	 * @param count The number of IDs
+	 */
+	virtual void setReceiveFilters(const canid_t *ids, uint8_t count) = 0;
+
+	/**
+	 * Accept every standard ID from now on, replacing the filters set with setReceiveFilters().
+	 */
+	virtual void receiveAllMessages() = 0;
+
+	/**
+	 * Read a received frame, if any.
+	 *
+	 * @param frame The frame to be filled
+	 * @return true if a frame has been read, false if there's nothing pending
+	 */
+	virtual bool readMessage(struct can_frame *frame) = 0;
+};
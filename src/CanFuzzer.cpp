@@ -5,57 +5,344 @@
 
 #include "CanFuzzer.h"
 
-#include "MessageDebouncer.h"
+#include <stdlib.h>
+#include <string.h>
+#include "Crc8.h"
 
-const size_t CanFuzzer::skipIdsCount = CanFuzzer::skipIdsSize / sizeof(canid_t);
+constexpr size_t CanFuzzer::SKIP_BITMAP_SIZE;
+constexpr uint8_t CanFuzzer::MAX_CAPTURED_FRAMES;
+constexpr uint8_t CanFuzzer::COMMAND_SIZE;
+constexpr uint8_t CanFuzzer::MAX_TRACKED_FRAMES;
+constexpr uint8_t CanFuzzer::LOG_SYNC;
+constexpr uint8_t CanFuzzer::LOG_FUZZED_FRAME;
+constexpr uint8_t CanFuzzer::LOG_RESPONSE_FRAME;
 
-void CanFuzzer::fuzzIds(MCP2515 &mcp2515) {
-	static MessageDebouncer messageDebouncer(100);
-	static canid_t lastId = CanFuzzer::startId;
-	static size_t skipIndex = 0;
+// Initialized on first use, so that builds not fuzzing don't need the cluster to define the IDs
+bool CanFuzzer::initialized = false;
+bool CanFuzzer::running = true;
+FuzzStrategy CanFuzzer::strategy = FuzzStrategy::ZEROS;
+canid_t CanFuzzer::rangeStartId = 0;
+canid_t CanFuzzer::rangeEndId = 0;
+uint16_t CanFuzzer::periodMs = 100;
+uint32_t CanFuzzer::lastStepMs = 0;
+canid_t CanFuzzer::currentId = 0;
+uint16_t CanFuzzer::currentStep = 0;
+struct can_frame CanFuzzer::capturedFrames[MAX_CAPTURED_FRAMES];
+uint8_t CanFuzzer::capturedFramesCount = 0;
+struct can_frame CanFuzzer::trackedFrames[MAX_TRACKED_FRAMES];
+uint8_t CanFuzzer::trackedFramesCount = 0;
+uint8_t CanFuzzer::nextTrackedFrame = 0;
+bool CanFuzzer::binaryLog = false;
+bool CanFuzzer::verbose = false;
+char CanFuzzer::command[COMMAND_SIZE];
+uint8_t CanFuzzer::commandLength = 0;
 
-	if (!messageDebouncer.shouldUpdate()) {
+void CanFuzzer::fuzzIds(CanBus &canBus) {
+	bool wasBinaryLog = binaryLog;
+
+	if (!initialized) {
+		initialized = true;
+		setRange(CanFuzzer::startId, CanFuzzer::endId);
+	}
+
+	while (Serial.available() > 0) {
+		char c = Serial.read();
+		if (c == '\n' || c == '\r') {
+			command[commandLength] = '\0';
+			if (commandLength > 0) {
+				handleCommand(command);
+			}
+			commandLength = 0;
+		} else if (commandLength < COMMAND_SIZE - 1) {
+			command[commandLength++] = c;
+		}
+	}
+
+	if (binaryLog && !wasBinaryLog) {
+		canBus.receiveAllMessages();
+		trackedFramesCount = 0;
+		nextTrackedFrame = 0;
+	} else if (!binaryLog && wasBinaryLog) {
+		canBus.setReceiveFilters(nullptr, 0);
+	}
+
+	if (!running) {
+		return;
+	}
+
+	struct can_frame frame;
+	while (canBus.readMessage(&frame)) {
+		if (binaryLog && isResponse(frame)) {
+			writeRecord(LOG_RESPONSE_FRAME, frame);
+		}
+	}
+
+	uint32_t currentTime = millis();
+	if (currentTime - lastStepMs < periodMs) {
+		return;
+	}
+	lastStepMs = currentTime;
+
+	if (strategy == FuzzStrategy::REPLAY && capturedFramesCount == 0) {
+		running = false;
+		print("No captured frames to replay");
+		return;
+	}
+
+	fillFrame(frame);
+
+	if (currentStep == 0) {
+		print("Fuzzing ID 0x" + String(frame.can_id, 16));
+	}
+
+	canBus.sendMessage(&frame);
+
+	if (binaryLog) {
+		writeRecord(LOG_FUZZED_FRAME, frame);
+	}
+
+	if (!nextStep()) {
+		print("Fuzzing done, restarting");
+	}
+}
+
+void CanFuzzer::handleCommand(char *command) {
+	char *name = strtok(command, " ");
+	char *firstArg = strtok(nullptr, " ");
+	char *secondArg = strtok(nullptr, " ");
+
+	// A line of spaces only
+	if (name == nullptr) {
 		return;
 	}
 
-	while (true) {
-		lastId++;
+	if (strcmp(name, "start") == 0) {
+		running = true;
+	} else if (strcmp(name, "stop") == 0) {
+		running = false;
+	} else if (strcmp(name, "range") == 0 && firstArg != nullptr && secondArg != nullptr) {
+		setRange(strtoul(firstArg, nullptr, 16), strtoul(secondArg, nullptr, 16));
+	} else if (strcmp(name, "strategy") == 0 && firstArg != nullptr) {
+		if (strcmp(firstArg, "zeros") == 0) {
+			strategy = FuzzStrategy::ZEROS;
+		} else if (strcmp(firstArg, "ones") == 0) {
+			strategy = FuzzStrategy::WALKING_ONES;
+		} else if (strcmp(firstArg, "bytes") == 0) {
+			strategy = FuzzStrategy::BYTE_SWEEP;
+		} else if (strcmp(firstArg, "replay") == 0) {
+			strategy = FuzzStrategy::REPLAY;
+		} else {
+			print("Unknown strategy");
+			return;
+		}
+		setRange(rangeStartId, rangeEndId);
+	} else if (strcmp(name, "period") == 0 && firstArg != nullptr) {
+		periodMs = strtoul(firstArg, nullptr, 10);
+	} else if (strcmp(name, "frame") == 0 && firstArg != nullptr && secondArg != nullptr) {
+		if (capturedFramesCount >= MAX_CAPTURED_FRAMES) {
+			print("Too many captured frames");
+			return;
+		}
 
-		if (lastId > CanFuzzer::endId) {
-			lastId = CanFuzzer::startId;
-			skipIndex = 0;
+		struct can_frame &frame = capturedFrames[capturedFramesCount];
+		frame.can_id = strtoul(firstArg, nullptr, 16) & CAN_SFF_MASK;
+		frame.can_dlc = 0;
+		for (uint8_t i = 0; secondArg[i * 2] != '\0' && secondArg[i * 2 + 1] != '\0' && i < CAN_MAX_DLEN; i++) {
+			char byteString[3] = { secondArg[i * 2], secondArg[i * 2 + 1], '\0' };
+			frame.data[i] = strtoul(byteString, nullptr, 16);
+			frame.can_dlc++;
 		}
+		capturedFramesCount++;
+	} else if (strcmp(name, "log") == 0 && firstArg != nullptr) {
+		binaryLog = strcmp(firstArg, "on") == 0;
+	} else if (strcmp(name, "verbose") == 0 && firstArg != nullptr) {
+		verbose = strcmp(firstArg, "on") == 0;
+	} else if (strcmp(name, "clear") == 0) {
+		capturedFramesCount = 0;
+		setRange(rangeStartId, rangeEndId);
+	} else if (strcmp(name, "status") != 0) {
+		print("Unknown command");
+		return;
+	}
+
+	printStatus();
+}
+
+void CanFuzzer::printStatus() {
+	print(String(running ? "Running" : "Stopped")
+		+ ", strategy " + String((int)strategy)
+		+ ", range 0x" + String(rangeStartId, 16) + "-0x" + String(rangeEndId, 16)
+		+ ", period " + String(periodMs) + " ms"
+		+ ", " + String(capturedFramesCount) + " captured frames");
+}
+
+void CanFuzzer::setRange(canid_t start, canid_t end) {
+	start &= CAN_SFF_MASK;
+	end &= CAN_SFF_MASK;
+
+	rangeStartId = start < end ? start : end;
+	rangeEndId = start < end ? end : start;
+	currentStep = 0;
+
+	if (strategy == FuzzStrategy::REPLAY) {
+		currentId = 0;
+		return;
+	}
+
+	// Start from the first ID not to be skipped
+	currentId = rangeEndId;
+	nextId();
+}
+
+bool CanFuzzer::isSkipped(canid_t id) {
+	return pgm_read_byte(&CanFuzzer::skipIdsBitmap[(id & CAN_SFF_MASK) >> 3]) & (1 << (id & 0x07));
+}
+
+uint16_t CanFuzzer::getStepsCount() {
+	switch (strategy) {
+		case FuzzStrategy::WALKING_ONES:
+			return CAN_MAX_DLEN * 8;
+		case FuzzStrategy::BYTE_SWEEP:
+			return CAN_MAX_DLEN * 256;
+		case FuzzStrategy::REPLAY:
+			return 1 + capturedFrames[currentId].can_dlc * 8;
+		case FuzzStrategy::ZEROS:
+		default:
+			return 1;
+	}
+}
 
-		while (skipIndex < CanFuzzer::skipIdsCount && lastId > CanFuzzer::skipIds[skipIndex]) {
-			skipIndex++;
+void CanFuzzer::fillFrame(struct can_frame &frame) {
+	if (strategy == FuzzStrategy::REPLAY) {
+		frame = capturedFrames[currentId];
+
+		// Step 0 replays the frame as is, step N flips payload bit N - 1
+		if (currentStep > 0) {
+			uint8_t bit = currentStep - 1;
+			frame.data[bit / 8] ^= 0x80 >> (bit % 8);
 		}
 
-		if (lastId != CanFuzzer::skipIds[skipIndex]) {
+		return;
+	}
+
+	frame.can_id = currentId;
+	frame.can_dlc = CAN_MAX_DLEN;
+	memset(frame.data, 0x00, sizeof(frame.data));
+
+	switch (strategy) {
+		case FuzzStrategy::WALKING_ONES:
+			frame.data[currentStep / 8] = 0x80 >> (currentStep % 8);
+			break;
+		case FuzzStrategy::BYTE_SWEEP:
+			frame.data[currentStep / 256] = currentStep % 256;
 			break;
+		case FuzzStrategy::ZEROS:
+		default:
+			break;
+	}
+}
+
+bool CanFuzzer::nextStep() {
+	currentStep++;
+	if (currentStep < getStepsCount()) {
+		return true;
+	}
+	currentStep = 0;
+
+	if (strategy == FuzzStrategy::REPLAY) {
+		currentId++;
+		if (currentId >= capturedFramesCount) {
+			currentId = 0;
+			return false;
+		}
+		return true;
+	}
+
+	return nextId();
+}
+
+bool CanFuzzer::nextId() {
+	bool wrapped = false;
+
+	for (canid_t i = rangeStartId; i <= rangeEndId; i++) {
+		if (currentId >= rangeEndId) {
+			currentId = rangeStartId;
+			wrapped = true;
 		} else {
-			Serial.println("Skipping ID 0x" + String(lastId, 16));
+			currentId++;
+		}
+
+		if (!isSkipped(currentId)) {
+			return !wrapped;
+		}
+
+		if (verbose) {
+			print("Skipping ID 0x" + String(currentId, 16));
 		}
 	}
 
-	fuzzId(mcp2515, lastId);
+	running = false;
+	print("Every ID in range is skipped");
+
+	return false;
 }
 
-void CanFuzzer::fuzzId(MCP2515 &mcp2515, canid_t id) {
-	struct can_frame frame;
+void CanFuzzer::print(const String &line) {
+	if (!binaryLog) {
+		Serial.println(line);
+	}
+}
+
+bool CanFuzzer::isResponse(const struct can_frame &frame) {
+	for (uint8_t i = 0; i < trackedFramesCount; i++) {
+		struct can_frame &trackedFrame = trackedFrames[i];
+		if (trackedFrame.can_id != frame.can_id) {
+			continue;
+		}
+
+		if (trackedFrame.can_dlc == frame.can_dlc
+				&& memcmp(trackedFrame.data, frame.data, frame.can_dlc) == 0) {
+			return false;
+		}
+
+		trackedFrame = frame;
+		return true;
+	}
+
+	trackedFrames[nextTrackedFrame] = frame;
+	nextTrackedFrame = (nextTrackedFrame + 1) % MAX_TRACKED_FRAMES;
+	if (trackedFramesCount < MAX_TRACKED_FRAMES) {
+		trackedFramesCount++;
+	}
+
+	return true;
+}
+
+void CanFuzzer::writeRecord(uint8_t type, const struct can_frame &frame) {
+	uint32_t timestamp = millis();
+	uint8_t dlc = frame.can_dlc <= CAN_MAX_DLEN ? frame.can_dlc : CAN_MAX_DLEN;
+	uint8_t record[] = {
+		LOG_SYNC,
+		(uint8_t)(8 + dlc),
+		type,
+		(uint8_t)timestamp,
+		(uint8_t)(timestamp >> 8),
+		(uint8_t)(timestamp >> 16),
+		(uint8_t)(timestamp >> 24),
+		(uint8_t)frame.can_id,
+		(uint8_t)((frame.can_id & CAN_SFF_MASK) >> 8),
+		dlc,
+	};
+
+	uint8_t crc = 0;
+	for (uint8_t i = 2; i < sizeof(record); i++) {
+		crc = crc8Update(crc, record[i]);
+	}
+	for (uint8_t i = 0; i < dlc; i++) {
+		crc = crc8Update(crc, frame.data[i]);
+	}
 
-	frame.can_id = id;
-	frame.can_dlc = 8;
-	frame.data[0] = 0x00;
-	frame.data[1] = 0x00;
-	frame.data[2] = 0x00;
-	frame.data[3] = 0x00;
-	frame.data[4] = 0x00;
-	frame.data[5] = 0x00;
-	frame.data[6] = 0x00;
-	frame.data[7] = 0x00;
-
-	Serial.println("Fuzzing ID 0x" + String(id, 16));
-	mcp2515.sendMessage(&frame);
-
-	delay(10);
+	Serial.write(record, sizeof(record));
+	Serial.write(frame.data, dlc);
+	Serial.write(crc);
 }
@@ -5,15 +5,130 @@
 
 #pragma once
 
-#include <mcp2515.h>
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "CanBus.h"
+
+/**
+ * A range of CAN IDs (inclusive) to skip or not to skip during fuzzing.
+ */
+struct CanIdRange {
+	canid_t firstId;
+	canid_t lastId;
+	bool skip;
+};
+
+/**
+ * Skip a single CAN ID.
+ */
+constexpr CanIdRange skipCanId(canid_t id) {
+	return { id, id, true };
+}
+
+/**
+ * Skip a range of CAN IDs (inclusive).
+ */
+constexpr CanIdRange skipCanIds(canid_t firstId, canid_t lastId) {
+	return { firstId, lastId, true };
+}
+
+/**
+ * Fuzz a range of CAN IDs (inclusive) even if skipped by a previous entry.
+ */
+constexpr CanIdRange fuzzCanIds(canid_t firstId, canid_t lastId) {
+	return { firstId, lastId, false };
+}
+
+/**
+ * @return Whether the ID must be skipped, the last entry containing it wins
+ */
+constexpr bool isCanIdSkipped(const CanIdRange *ranges, size_t count, canid_t id) {
+	return count == 0 ? false
+		: ranges[count - 1].firstId <= id && id <= ranges[count - 1].lastId ? ranges[count - 1].skip
+		: isCanIdSkipped(ranges, count - 1, id);
+}
+
+/**
+ * @return A byte of the skip bitmap, bit N of byte M being the ID M * 8 + N
+ */
+constexpr uint8_t canIdBitmapByte(const CanIdRange *ranges, size_t count, size_t byteIndex, uint8_t bit = 0) {
+	return bit == 8 ? 0
+		: (isCanIdSkipped(ranges, count, byteIndex * 8 + bit) ? 1 << bit : 0)
+			| canIdBitmapByte(ranges, count, byteIndex, bit + 1);
+}
+
+#define CAN_ID_BITMAP_BYTES_4(ranges, i) \
+	canIdBitmapByte(ranges, sizeof(ranges) / sizeof(ranges[0]), (i)), \
+	canIdBitmapByte(ranges, sizeof(ranges) / sizeof(ranges[0]), (i) + 1), \
+	canIdBitmapByte(ranges, sizeof(ranges) / sizeof(ranges[0]), (i) + 2), \
+	canIdBitmapByte(ranges, sizeof(ranges) / sizeof(ranges[0]), (i) + 3)
+#define CAN_ID_BITMAP_BYTES_16(ranges, i) \
+	CAN_ID_BITMAP_BYTES_4(ranges, (i)), CAN_ID_BITMAP_BYTES_4(ranges, (i) + 4), \
+	CAN_ID_BITMAP_BYTES_4(ranges, (i) + 8), CAN_ID_BITMAP_BYTES_4(ranges, (i) + 12)
+#define CAN_ID_BITMAP_BYTES_64(ranges, i) \
+	CAN_ID_BITMAP_BYTES_16(ranges, (i)), CAN_ID_BITMAP_BYTES_16(ranges, (i) + 16), \
+	CAN_ID_BITMAP_BYTES_16(ranges, (i) + 32), CAN_ID_BITMAP_BYTES_16(ranges, (i) + 48)
+
+/**
+ * Initializer of a skip bitmap covering all the standard IDs, built at compile time from a
+ * constexpr array of CanIdRange (in any order).
+ */
+#define CAN_ID_BITMAP(ranges) { \
+	CAN_ID_BITMAP_BYTES_64(ranges, 0), CAN_ID_BITMAP_BYTES_64(ranges, 64), \
+	CAN_ID_BITMAP_BYTES_64(ranges, 128), CAN_ID_BITMAP_BYTES_64(ranges, 192) \
+}
+
+/**
+ * Payload generation strategies.
+ */
+enum class FuzzStrategy {
+	ZEROS = 0, // One all-zero frame per ID
+	WALKING_ONES = 1, // One frame per payload bit, with only that bit set
+	BYTE_SWEEP = 2, // Every value of every payload byte, one byte at a time
+	REPLAY = 3, // Captured frames, then each one with one bit flipped at a time
+};
 
 /**
  * Utilities for finding CAN IDs.
+ *
+ * It's controlled with line based commands over the serial port (so SimHub must not be connected):
+ * - start / stop
+ * - range <start ID> <end ID>: IDs in hex, inclusive
+ * - strategy <zeros|ones|bytes|replay>
+ * - period <ms>: Minimum time between two frames
+ * - frame <ID> <payload>: Capture a frame for replay, both in hex (e.g. frame 128 0011223344556677)
+ * - clear: Forget the captured frames
+ * - log <on|off>: Binary log of the sent frames and the responses, see below
+ * - verbose <on|off>: Also print the skipped IDs, off by default
+ * - status
+ *
+ * With the binary log enabled every frame on the bus is accepted and the text output is muted, turning
+ * it off closes the receive filters again. Each frame is written as a record, all the fields
+ * being little endian:
+ * - uint8_t: LOG_SYNC
+ * - uint8_t: Length of the fields from the type to the payload, 8 + DLC
+ * - uint8_t: LOG_FUZZED_FRAME for a frame sent by the fuzzer, LOG_RESPONSE_FRAME for a received one
+ * - uint32_t: millis() when it was sent or read
+ * - uint16_t: CAN ID
+ * - uint8_t: DLC
+ * - DLC bytes: payload
+ * - uint8_t: CRC-8 (see Crc8.h) of the fields from the type to the payload
+ * LOG_SYNC may appear in any field, a reader resyncing looks for a LOG_SYNC followed by a valid
+ * length and a matching CRC.
+ * Received frames are only logged when their ID is new or their payload changed, so the periodic
+ * frames of the cluster don't flood the log. They belong to the last fuzzed frame before them.
  */
 class CanFuzzer {
 public:
-	static void fuzzIds(MCP2515 &mcp2515);
+	/**
+	 * Handle pending commands and send the next frame if it's due. Never blocks, to be called on
+	 * every loop.
+	 *
+	 * @param canBus The bus to fuzz
+	 */
+	static void fuzzIds(CanBus &canBus);
 
 	/**
 	 * Start ID for fuzzing (inclusive).
@@ -25,18 +140,97 @@ public:
 	 */
 	static const canid_t endId;
 
+	static constexpr uint8_t LOG_SYNC = 0xA5;
+	static constexpr uint8_t LOG_FUZZED_FRAME = 'F';
+	static constexpr uint8_t LOG_RESPONSE_FRAME = 'R';
+
+	static constexpr size_t SKIP_BITMAP_SIZE = (CAN_SFF_MASK + 1) / 8;
+
 	/**
-	 * List of CAN IDs to skip during fuzzing. Must be sorted in ascending order.
+	 * Bitmap of the CAN IDs to skip during fuzzing, in PROGMEM. Define it with CAN_ID_BITMAP().
 	 */
-	static const canid_t skipIds[];
+	static const uint8_t skipIdsBitmap[SKIP_BITMAP_SIZE];
+
+private:
+	static void handleCommand(char *command);
+
+	static void printStatus();
 
 	/**
-	 * sizeof(skipIds).
+	 * Set the range and restart from its beginning.
 	 */
-	static const size_t skipIdsSize;
+	static void setRange(canid_t start, canid_t end);
 
-private:
-	static void fuzzId(MCP2515 &mcp2515, canid_t id);
+	static bool isSkipped(canid_t id);
+
+	/**
+	 * @return The number of frames to be sent for the current ID
+	 */
+	static uint16_t getStepsCount();
+
+	static void fillFrame(struct can_frame &frame);
+
+	/**
+	 * Move to the next frame.
+	 *
+	 * @return false if the sweep wrapped around, true otherwise
+	 */
+	static bool nextStep();
+
+	/**
+	 * Move to the next ID not to be skipped.
+	 *
+	 * @return false if the range wrapped around, true otherwise
+	 */
+	static bool nextId();
+
+	/**
+	 * Print a line unless the binary log is enabled.
+	 */
+	static void print(const String &line);
+
+	/**
+	 * @return Whether the received frame is new or changed since the last time it was seen
+	 */
+	static bool isResponse(const struct can_frame &frame);
+
+	static void writeRecord(uint8_t type, const struct can_frame &frame);
+
+	static constexpr uint8_t MAX_CAPTURED_FRAMES = 8;
+	static constexpr uint8_t COMMAND_SIZE = 40;
+	static constexpr uint8_t MAX_TRACKED_FRAMES = 12;
+
+	static bool initialized;
+	static bool running;
+	static FuzzStrategy strategy;
+	static canid_t rangeStartId;
+	static canid_t rangeEndId;
+	static uint16_t periodMs;
+	static uint32_t lastStepMs;
+
+	/**
+	 * Current ID, index of the captured frame when replaying.
+	 */
+	static canid_t currentId;
+
+	/**
+	 * Current step for the current ID, see getStepsCount().
+	 */
+	static uint16_t currentStep;
+
+	static struct can_frame capturedFrames[MAX_CAPTURED_FRAMES];
+	static uint8_t capturedFramesCount;
+
+	/**
+	 * Last frame seen for each received ID, replaced round robin when full.
+	 */
+	static struct can_frame trackedFrames[MAX_TRACKED_FRAMES];
+	static uint8_t trackedFramesCount;
+	static uint8_t nextTrackedFrame;
+
+	static bool binaryLog;
+	static bool verbose;
 
-	static const size_t skipIdsCount;
+	static char command[COMMAND_SIZE];
+	static uint8_t commandLength;
 };
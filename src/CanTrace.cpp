@@ -0,0 +1,245 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "CanTrace.h"
+
+#include <stdlib.h>
+
+constexpr uint8_t CanTraceReplayer::LINE_SIZE;
+constexpr uint32_t CanTraceReplayer::MAX_DELAY_SECONDS;
+
+static void writeHex(Print &output, uint32_t value, uint8_t digits) {
+	static const char hexDigits[] = "0123456789ABCDEF";
+
+	while (digits-- > 0) {
+		output.print(hexDigits[(value >> (digits * 4)) & 0x0F]);
+	}
+}
+
+static void writeDecimal(Print &output, uint32_t value, uint8_t digits) {
+	char buffer[10];
+
+	for (uint8_t i = digits; i > 0; i--) {
+		buffer[i - 1] = '0' + value % 10;
+		value /= 10;
+	}
+
+	output.write((const uint8_t *)buffer, digits);
+}
+
+/**
+ * Parse up to maxDigits hex digits.
+ *
+ * @return The number of digits parsed
+ */
+static uint8_t parseHex(const char *&string, uint32_t &value, uint8_t maxDigits) {
+	uint8_t digits = 0;
+
+	value = 0;
+	for (; digits < maxDigits; digits++, string++) {
+		char c = *string;
+		uint8_t digit;
+		if (c >= '0' && c <= '9') {
+			digit = c - '0';
+		} else if (c >= 'A' && c <= 'F') {
+			digit = c - 'A' + 10;
+		} else if (c >= 'a' && c <= 'f') {
+			digit = c - 'a' + 10;
+		} else {
+			break;
+		}
+		value = (value << 4) | digit;
+	}
+
+	return digits;
+}
+
+void writeCandumpLine(Print &output, uint32_t seconds, uint32_t microseconds,
+		const char *interfaceName, const struct can_frame &frame) {
+	output.print('(');
+	writeDecimal(output, seconds, 10);
+	output.print('.');
+	writeDecimal(output, microseconds, 6);
+	output.print(") ");
+	output.print(interfaceName);
+	output.print(' ');
+
+	if (frame.can_id & CAN_EFF_FLAG) {
+		writeHex(output, frame.can_id & CAN_EFF_MASK, 8);
+	} else {
+		writeHex(output, frame.can_id & CAN_SFF_MASK, 3);
+	}
+	output.print('#');
+
+	if (frame.can_id & CAN_RTR_FLAG) {
+		output.print('R');
+	} else {
+		for (uint8_t i = 0; i < frame.can_dlc && i < CAN_MAX_DLEN; i++) {
+			writeHex(output, frame.data[i], 2);
+		}
+	}
+
+	output.print('\n');
+}
+
+bool parseCandumpLine(const char *line, uint32_t &seconds, uint32_t &microseconds,
+		struct can_frame &frame) {
+	char *end;
+
+	if (*line++ != '(') {
+		return false;
+	}
+
+	seconds = strtoul(line, &end, 10);
+	if (end == line || *end != '.') {
+		return false;
+	}
+	line = end + 1;
+
+	microseconds = strtoul(line, &end, 10);
+	if (end - line != 6 || *end != ')') {
+		return false;
+	}
+	line = end + 1;
+
+	// Skip the interface name
+	while (*line == ' ') {
+		line++;
+	}
+	while (*line != ' ' && *line != '\0') {
+		line++;
+	}
+	while (*line == ' ') {
+		line++;
+	}
+
+	uint32_t value;
+	uint8_t digits = parseHex(line, value, 8);
+	if (digits == 3 && value <= CAN_SFF_MASK) {
+		frame.can_id = value;
+	} else if (digits == 8 && value <= CAN_EFF_MASK) {
+		frame.can_id = value | CAN_EFF_FLAG;
+	} else {
+		return false;
+	}
+
+	if (*line++ != '#') {
+		return false;
+	}
+
+	frame.can_dlc = 0;
+	if (*line == 'R') {
+		frame.can_id |= CAN_RTR_FLAG;
+		return true;
+	}
+
+	while (*line != '\0') {
+		if (frame.can_dlc >= CAN_MAX_DLEN || parseHex(line, value, 2) != 2) {
+			return false;
+		}
+		frame.data[frame.can_dlc++] = value;
+	}
+
+	return true;
+}
+
+CanTraceRecorder::CanTraceRecorder(CanBus &canBus, Print &output, const char *interfaceName)
+		: canBus(canBus), output(output), interfaceName(interfaceName) {}
+
+void CanTraceRecorder::setup(uint32_t bitrate) {
+	canBus.setup(bitrate);
+}
+
+bool CanTraceRecorder::sendMessage(const struct can_frame *frame) {
+	if (!canBus.sendMessage(frame)) {
+		return false;
+	}
+
+	record(*frame);
+	return true;
+}
+
+void CanTraceRecorder::setReceiveFilters(const canid_t *ids, uint8_t count) {
+	canBus.setReceiveFilters(ids, count);
+}
+
+void CanTraceRecorder::receiveAllMessages() {
+	canBus.receiveAllMessages();
+}
+
+bool CanTraceRecorder::readMessage(struct can_frame *frame) {
+	if (!canBus.readMessage(frame)) {
+		return false;
+	}
+
+	record(*frame);
+	return true;
+}
+
+void CanTraceRecorder::record(const struct can_frame &frame) {
+	uint32_t currentMicros = micros();
+	microseconds += currentMicros - lastMicros;
+	lastMicros = currentMicros;
+
+	seconds += microseconds / 1000000;
+	microseconds %= 1000000;
+
+	writeCandumpLine(output, seconds, microseconds, interfaceName, frame);
+}
+
+CanTraceReplayer::CanTraceReplayer(Stream &input, CanBus &canBus)
+		: input(input), canBus(canBus) {}
+
+void CanTraceReplayer::poll() {
+	while (!framePending && input.available() > 0) {
+		char c = input.read();
+		if (c != '\n' && c != '\r') {
+			if (lineLength < LINE_SIZE - 1) {
+				line[lineLength++] = c;
+			}
+			continue;
+		}
+
+		line[lineLength] = '\0';
+		uint32_t seconds;
+		uint32_t microseconds;
+		framePending = lineLength > 0 && parseCandumpLine(line, seconds, microseconds, pendingFrame);
+		lineLength = 0;
+
+		if (!framePending) {
+			continue;
+		}
+
+		// The first frame is sent right away, the others after the same time they had in the log
+		if (!anyFrameSent) {
+			pendingDelayUs = 0;
+		} else if (seconds < lastSeconds || (seconds == lastSeconds && microseconds < lastMicroseconds)) {
+			pendingDelayUs = 0;
+		} else if (seconds - lastSeconds > MAX_DELAY_SECONDS) {
+			pendingDelayUs = MAX_DELAY_SECONDS * 1000000;
+		} else {
+			pendingDelayUs = (seconds - lastSeconds) * 1000000 + microseconds - lastMicroseconds;
+		}
+
+		lastSeconds = seconds;
+		lastMicroseconds = microseconds;
+	}
+
+	if (!framePending) {
+		return;
+	}
+
+	uint32_t currentMicros = micros();
+	if (anyFrameSent && currentMicros - lastSentMicros < pendingDelayUs) {
+		return;
+	}
+
+	canBus.sendMessage(&pendingFrame);
+
+	// Schedule from when the frame was due rather than from now, so lateness doesn't add up
+	lastSentMicros = anyFrameSent ? lastSentMicros + pendingDelayUs : currentMicros;
+	anyFrameSent = true;
+	framePending = false;
+}
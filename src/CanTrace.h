@@ -0,0 +1,124 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <mcp2515.h>
+#include <stdint.h>
+#include "CanBus.h"
+
+/**
+ * Write a frame as a Linux candump -l log line, e.g. "(0000000012.345678) can0 0B6#0011223344556677".
+ *
+ * @param output Where to write the line to
+ * @param seconds Timestamp, seconds part
+ * @param microseconds Timestamp, microseconds part
+ * @param interfaceName The interface name to be logged
+ * @param frame The frame to be logged
+ */
+void writeCandumpLine(Print &output, uint32_t seconds, uint32_t microseconds,
+		const char *interfaceName, const struct can_frame &frame);
+
+/**
+ * Parse a Linux candump -l log line. The interface name is ignored.
+ *
+ * @param line The NUL terminated line, without the line terminator
+ * @param seconds Timestamp, seconds part
+ * @param microseconds Timestamp, microseconds part
+ * @param frame The frame to be filled
+ * @return true if the line has been parsed, false otherwise
+ */
+bool parseCandumpLine(const char *line, uint32_t &seconds, uint32_t &microseconds,
+		struct can_frame &frame);
+
+/**
+ * CAN bus recording every frame sent and received through another bus in candump -l format.
+ * The timestamps start from the boot of the Arduino.
+ */
+class CanTraceRecorder : public CanBus {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param canBus The bus to be recorded
+	 * @param output Where to write the trace to, must not be the port SimHub is connected to
+	 * @param interfaceName The interface name to be logged, e.g. "can0"
+	 */
+	CanTraceRecorder(CanBus &canBus, Print &output, const char *interfaceName);
+
+	void setup(uint32_t bitrate) override;
+
+	bool sendMessage(const struct can_frame *frame) override;
+
+	void setReceiveFilters(const canid_t *ids, uint8_t count) override;
+
+	void receiveAllMessages() override;
+
+	bool readMessage(struct can_frame *frame) override;
+
+private:
+	void record(const struct can_frame &frame);
+
+	CanBus &canBus;
+	Print &output;
+	const char *interfaceName;
+
+	/**
+	 * micros() wraps around every ~71 minutes, so keep our own clock.
+	 */
+	uint32_t lastMicros = 0;
+	uint32_t seconds = 0;
+	uint32_t microseconds = 0;
+};
+
+/**
+ * Replay a candump -l log to a CAN bus, keeping the original time between the frames.
+ */
+class CanTraceReplayer {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param input Where to read the log from, must not be the port SimHub is connected to
+	 * @param canBus The bus to send the frames to
+	 */
+	CanTraceReplayer(Stream &input, CanBus &canBus);
+
+	/**
+	 * Read the log and send the next frame if it's due. Never blocks, to be called on every loop.
+	 */
+	void poll();
+
+private:
+	static constexpr uint8_t LINE_SIZE = 64;
+
+	/**
+	 * Longer gaps in the log are shortened, so that the delay fits in micros().
+	 */
+	static constexpr uint32_t MAX_DELAY_SECONDS = 60;
+
+	Stream &input;
+	CanBus &canBus;
+
+	char line[LINE_SIZE];
+	uint8_t lineLength = 0;
+
+	bool framePending = false;
+	struct can_frame pendingFrame;
+
+	/**
+	 * Timestamp of the last frame sent, in the log clock and in ours.
+	 */
+	bool anyFrameSent = false;
+	uint32_t lastSeconds = 0;
+	uint32_t lastMicroseconds = 0;
+	uint32_t lastSentMicros = 0;
+
+	/**
+	 * Time to wait after the last frame sent before sending the pending one.
+	 */
+	uint32_t pendingDelayUs = 0;
+};
@@ -5,21 +5,67 @@
 
 #pragma once
 
+#include <stdint.h>
+#include "CanBus.h"
 #include "types.h"
 
+/**
+ * What became of a frame to be sent right away.
+ */
+enum class ExpeditedFrameStatus {
+	NOT_SUPPORTED = 0, // The cluster doesn't send it
+	SENT = 1,
+	DEFERRED = 2, // The cluster got a frame too recently, the next updateState() sends it
+};
+
 /**
  * Cluster.
  */
 class Cluster {
 public:
+	/**
+	 * Constructor.
+	 *
+	 * @param canBus The CAN bus the cluster is connected to
+	 */
+	Cluster(CanBus &canBus) : canBus(canBus) {}
+
 	/**
 	 * Initialize the cluster.
 	 */
-	static void setup();
+	virtual void setup() = 0;
 
 	/**
 	 * Push the current state to the cluster.
 	 * @param state The current state to be pushed.
 	 */
-	static void updateState(State &state);
+	virtual void updateState(State &state) = 0;
+
+	/**
+	 * @return The fuel tank capacity of the car the cluster comes from, to compute the range
+	 */
+	virtual uint8_t getTankCapacityLiters() const = 0;
+
+	/**
+	 * Send the RPM and the speed right away, without waiting for their next periodic frame, as long
+	 * as the cluster can take another frame this soon.
+	 *
+	 * @param state The current state
+	 * @return Whether the frame has been sent or deferred to the next updateState() sending it as
+	 *         soon as possible, or whether the cluster has no such frame
+	 */
+	virtual ExpeditedFrameStatus updateRpmAndSpeed(State &state) {
+		(void)state;
+		return ExpeditedFrameStatus::NOT_SUPPORTED;
+	}
+
+	/**
+	 * @return Whether the frame deferred by updateRpmAndSpeed() is still waiting to be sent
+	 */
+	virtual bool isRpmAndSpeedDeferred() const {
+		return false;
+	}
+
+protected:
+	CanBus &canBus;
 };
@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+// Flash and RAM are the same elsewhere, e.g. in the host benchmark
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#endif
+#endif
+
+/**
+ * CRC-8 with polynomial 0xD5 and no reflection, the one used by the SimHub ARQ protocol.
+ *
+ * Each implementation updates the CRC with one byte, so it can be computed while the bytes arrive:
+ * - PROGMEM table: 256 bytes of flash, one flash read per byte
+ * - Nibble tables: 32 bytes of SRAM, two SRAM reads per byte
+ * - Bitwise: no table, eight shifts per byte
+ *
+ * Select the one used by crc8Update() with CRC8_IMPLEMENTATION, "X crcbench" times them all on the
+ * device and host/crc8_benchmark on the PC.
+ */
+#define CRC8_PROGMEM_TABLE 0
+#define CRC8_NIBBLE_TABLES 1
+#define CRC8_BITWISE 2
+
+#ifndef CRC8_IMPLEMENTATION
+#define CRC8_IMPLEMENTATION CRC8_PROGMEM_TABLE
+#endif
+
+extern const uint8_t crc8Table[256] PROGMEM;
+extern const uint8_t crc8HighNibbleTable[16];
+extern const uint8_t crc8LowNibbleTable[16];
+
+static inline uint8_t crc8UpdateProgmemTable(uint8_t crc, uint8_t value) {
+	return pgm_read_byte(&crc8Table[crc ^ value]);
+}
+
+static inline uint8_t crc8UpdateNibbleTables(uint8_t crc, uint8_t value) {
+	crc ^= value;
+	return crc8HighNibbleTable[crc >> 4] ^ crc8LowNibbleTable[crc & 0x0F];
+}
+
+static inline uint8_t crc8UpdateBitwise(uint8_t crc, uint8_t value) {
+	crc ^= value;
+	for (uint8_t i = 0; i < 8; i++) {
+		crc = crc & 0x80 ? (crc << 1) ^ 0xD5 : crc << 1;
+	}
+	return crc;
+}
+
+static inline uint8_t crc8Update(uint8_t crc, uint8_t value) {
+#if CRC8_IMPLEMENTATION == CRC8_NIBBLE_TABLES
+	return crc8UpdateNibbleTables(crc, value);
+#elif CRC8_IMPLEMENTATION == CRC8_BITWISE
+	return crc8UpdateBitwise(crc, value);
+#else
+	return crc8UpdateProgmemTable(crc, value);
+#endif
+}
@@ -0,0 +1,166 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "Mcp2515CanBus.h"
+
+#include <Arduino.h>
+
+constexpr uint8_t Mcp2515CanBus::NO_INT_PIN;
+constexpr uint8_t Mcp2515CanBus::MAX_INT_PINS;
+
+static const MCP2515::RXF filters[] = {
+	MCP2515::RXF0,
+	MCP2515::RXF1,
+	MCP2515::RXF2,
+	MCP2515::RXF3,
+	MCP2515::RXF4,
+	MCP2515::RXF5,
+};
+static constexpr uint8_t filtersCount = sizeof(filters) / sizeof(filters[0]);
+
+volatile bool Mcp2515CanBus::interruptPending[MAX_INT_PINS] = {};
+uint8_t Mcp2515CanBus::interruptSlotsCount = 0;
+
+Mcp2515CanBus::Mcp2515CanBus(uint8_t csPin, uint8_t intPin, CAN_CLOCK clock)
+		: mcp2515(csPin), intPin(intPin), clock(clock) {}
+
+void Mcp2515CanBus::setup(uint32_t bitrate) {
+	CAN_SPEED canSpeed;
+	switch (bitrate) {
+		case 50000:
+			canSpeed = CAN_50KBPS;
+			break;
+		case 100000:
+			canSpeed = CAN_100KBPS;
+			break;
+		case 125000:
+			canSpeed = CAN_125KBPS;
+			break;
+		case 250000:
+			canSpeed = CAN_250KBPS;
+			break;
+		case 500000:
+			canSpeed = CAN_500KBPS;
+			break;
+		case 1000000:
+			canSpeed = CAN_1000KBPS;
+			break;
+		default:
+			canSpeed = CAN_125KBPS; // Default to PSA comfort bus bitrate
+			break;
+	}
+
+	mcp2515.reset();
+	mcp2515.setBitrate(canSpeed, clock);
+	configureFilters(nullptr, 0);
+	mcp2515.setNormalMode();
+
+	if (intPin != NO_INT_PIN && interruptSlot == NO_INT_PIN && interruptSlotsCount < MAX_INT_PINS) {
+		static void (*const handlers[MAX_INT_PINS])() = {
+			onInterrupt0,
+			onInterrupt1,
+		};
+
+		interruptSlot = interruptSlotsCount++;
+		pinMode(intPin, INPUT);
+		attachInterrupt(digitalPinToInterrupt(intPin), handlers[interruptSlot], FALLING);
+	}
+}
+
+bool Mcp2515CanBus::sendMessage(const struct can_frame *frame) {
+	return mcp2515.sendMessage(frame) == MCP2515::ERROR_OK;
+}
+
+void Mcp2515CanBus::setReceiveFilters(const canid_t *ids, uint8_t count) {
+	mcp2515.setConfigMode();
+	configureFilters(ids, count);
+	mcp2515.setNormalMode();
+}
+
+void Mcp2515CanBus::receiveAllMessages() {
+	mcp2515.setConfigMode();
+	// A zero mask makes every filter match, as long as it is a standard one
+	mcp2515.setFilterMask(MCP2515::MASK0, false, 0);
+	mcp2515.setFilterMask(MCP2515::MASK1, false, 0);
+	for (uint8_t i = 0; i < filtersCount; i++) {
+		mcp2515.setFilter(filters[i], false, 0);
+	}
+	mcp2515.setNormalMode();
+}
+
+bool Mcp2515CanBus::readMessage(struct can_frame *frame) {
+	if (interruptSlot != NO_INT_PIN) {
+		// Clear the flag before draining, a frame arriving meanwhile makes INT fall again and sets it
+		if (interruptPending[interruptSlot]) {
+			interruptPending[interruptSlot] = false;
+			draining = true;
+		} else if (!draining) {
+			// No edge, but INT may still be low if it never went back high (e.g. a frame arrived
+			// while an error flag held it low), poll the controller then
+			if (digitalRead(intPin) == HIGH) {
+				return false;
+			}
+			draining = true;
+		}
+
+		// The INT line only falls once even if both RX buffers are full, so keep reading until
+		// the controller has nothing left
+		if (mcp2515.readMessage(frame) == MCP2515::ERROR_OK) {
+			return true;
+		}
+
+		draining = false;
+
+		// Error flags (enabled by reset()) also hold INT low, clear them so that the next frame
+		// makes it fall. clearInterrupts() would also release RX buffers filled since the last read
+		mcp2515.clearERRIF();
+		mcp2515.clearMERR();
+		return false;
+	}
+
+	if (!mcp2515.checkReceive()) {
+		return false;
+	}
+
+	return mcp2515.readMessage(frame) == MCP2515::ERROR_OK;
+}
+
+void Mcp2515CanBus::configureFilters(const canid_t *ids, uint8_t count) {
+	if (count == 0) {
+		// Extended filters never match a standard frame, whatever ID they hold
+		mcp2515.setFilterMask(MCP2515::MASK0, true, CAN_EFF_MASK);
+		mcp2515.setFilterMask(MCP2515::MASK1, true, CAN_EFF_MASK);
+		for (uint8_t i = 0; i < filtersCount; i++) {
+			mcp2515.setFilter(filters[i], true, CAN_EFF_MASK);
+		}
+		return;
+	}
+
+	// Exact match when the IDs fit in the acceptance filters, otherwise only compare the bits
+	// all the IDs have in common and let the cluster drop the extra frames
+	uint32_t mask = CAN_SFF_MASK;
+	if (count > filtersCount) {
+		for (uint8_t i = 1; i < count; i++) {
+			mask &= ~(ids[i] ^ ids[0]);
+		}
+	}
+
+	mcp2515.setFilterMask(MCP2515::MASK0, false, mask);
+	mcp2515.setFilterMask(MCP2515::MASK1, false, mask);
+
+	for (uint8_t i = 0; i < filtersCount; i++) {
+		// Spare filters repeat the last ID
+		canid_t id = ids[i < count ? i : count - 1];
+		mcp2515.setFilter(filters[i], false, id & CAN_SFF_MASK);
+	}
+}
+
+void Mcp2515CanBus::onInterrupt0() {
+	interruptPending[0] = true;
+}
+
+void Mcp2515CanBus::onInterrupt1() {
+	interruptPending[1] = true;
+}
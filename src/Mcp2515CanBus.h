@@ -0,0 +1,63 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <mcp2515.h>
+#include <stdint.h>
+#include "CanBus.h"
+
+/**
+ * CAN bus backed by a MCP2515 controller on the SPI bus.
+ */
+class Mcp2515CanBus : public CanBus {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param csPin The SPI chip select pin the MCP2515 is wired to
+	 * @param intPin The interrupt capable pin the MCP2515 INT line is wired to, NO_INT_PIN to poll
+	 *               the controller over SPI instead. At most MAX_INT_PINS buses can use it
+	 * @param clock The frequency of the crystal on the MCP2515 module
+	 */
+	Mcp2515CanBus(uint8_t csPin, uint8_t intPin = NO_INT_PIN, CAN_CLOCK clock = MCP_8MHZ);
+
+	void setup(uint32_t bitrate) override;
+
+	bool sendMessage(const struct can_frame *frame) override;
+
+	void setReceiveFilters(const canid_t *ids, uint8_t count) override;
+
+	void receiveAllMessages() override;
+
+	bool readMessage(struct can_frame *frame) override;
+
+	static constexpr uint8_t NO_INT_PIN = 0xFF;
+
+	static constexpr uint8_t MAX_INT_PINS = 2;
+
+private:
+	void configureFilters(const canid_t *ids, uint8_t count);
+
+	MCP2515 mcp2515;
+	uint8_t intPin;
+	CAN_CLOCK clock;
+
+	/**
+	 * Index in interruptPending, NO_INT_PIN if the INT line isn't used.
+	 */
+	uint8_t interruptSlot = NO_INT_PIN;
+
+	/**
+	 * Whether readMessage() is emptying the RX buffers after an interrupt.
+	 */
+	bool draining = false;
+
+	static volatile bool interruptPending[MAX_INT_PINS];
+	static uint8_t interruptSlotsCount;
+
+	static void onInterrupt0();
+	static void onInterrupt1();
+};
@@ -7,21 +7,28 @@
 
 #include <Arduino.h>
 
-MessageDebouncer::MessageDebouncer(uint16_t delayMs) : debounceDelayMs(delayMs) {}
+MessageDebouncer::MessageDebouncer(uint16_t delayMs, uint16_t expeditedDelayMs)
+		: debounceDelayMs(delayMs), expeditedDelayMs(expeditedDelayMs) {}
 
 bool MessageDebouncer::shouldUpdate() {
 	uint32_t currentTime = millis();
 
 	if (!sentAnyMessage) [[unlikely]] {
 		sentAnyMessage = true;
+		expedited = false;
 		lastPoll = currentTime;
 		return true; // First message, always send
 	}
 
-	if (currentTime - lastPoll > debounceDelayMs) {
+	if (currentTime - lastPoll > (expedited ? expeditedDelayMs : debounceDelayMs)) {
+		expedited = false;
 		lastPoll = currentTime;
 		return true;
 	}
 
 	return false;
 }
+
+void MessageDebouncer::expedite() {
+	expedited = true;
+}
@@ -17,8 +17,10 @@ public:
 	 *
 	 * @param delayMs The minimum debounce delay in milliseconds to wait before sending the next
 	 *                message
+	 * @param expeditedDelayMs The minimum delay in milliseconds between two messages when the next
+	 *                         one is expedited, the least the receiver can handle
 	 */
-	MessageDebouncer(uint16_t delayMs);
+	MessageDebouncer(uint16_t delayMs, uint16_t expeditedDelayMs = 0);
 
 	/**
 	 * Check if the message should be sent. If true, it updates the last poll time.
@@ -27,8 +29,22 @@ public:
 	 */
 	bool shouldUpdate();
 
+	/**
+	 * Send the next message as soon as the expedited delay allows, e.g. because the data changed.
+	 */
+	void expedite();
+
+	/**
+	 * @return Whether an expedited message is still waiting for its delay
+	 */
+	bool isExpedited() const {
+		return expedited;
+	}
+
 private:
 	uint16_t debounceDelayMs;
+	uint16_t expeditedDelayMs;
+	bool expedited = false;
 	bool sentAnyMessage = false;
 	uint32_t lastPoll = 0;
 };
@@ -0,0 +1,255 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "StateFields.h"
+
+/**
+ * Resumable parser of the SimHub custom protocol message, fed a byte at a time as the bytes arrive.
+ *
+ * Each field is decoded while its bytes arrive and only its value is kept, in the order the fields
+ * are sent. Once the last field completed the values are read back in the same order with the
+ * next*() functions, so the message is applied as a whole.
+ *
+ * @tparam FIELDS The fields sent by SimHub
+ */
+template <StateFieldMask FIELDS>
+class MessageParser {
+public:
+	/**
+	 * Start parsing a new message, dropping the current one.
+	 *
+	 * @return Whether there's anything to parse
+	 */
+	bool begin() {
+		writeSlot = 0;
+		field = getNextField(0);
+		resetField();
+		return isActive();
+	}
+
+	/**
+	 * @return Whether a message is being parsed
+	 */
+	bool isActive() const {
+		return field < (uint8_t)StateField::COUNT;
+	}
+
+	/**
+	 * Stop parsing the current message.
+	 */
+	void abort() {
+		field = (uint8_t)StateField::COUNT;
+	}
+
+	/**
+	 * Parse a byte of the message.
+	 *
+	 * @return Whether the message is complete, the values can be read
+	 */
+	bool feed(char c) {
+		if (!isActive()) {
+			return false;
+		}
+
+		if (c == ';') {
+			completeField();
+			if (isActive()) {
+				return false;
+			}
+
+			readSlot = 0;
+			return true;
+		}
+
+		switch (getStateFieldFormat((StateField)field)) {
+			case StateFieldFormat::TOKEN:
+				feedToken(c);
+				break;
+			case StateFieldFormat::INTEGER:
+				feedInteger(c);
+				break;
+			case StateFieldFormat::DECI:
+				feedDeci(c);
+				break;
+			case StateFieldFormat::CHARACTER:
+				if (!started) {
+					value = c;
+					started = true;
+				}
+				break;
+		}
+
+		return false;
+	}
+
+	/**
+	 * @return The index of the token in getStateFieldTokens(), -1 if it's none of them
+	 */
+	int8_t nextToken() {
+		return values[readSlot++].token;
+	}
+
+	int32_t nextInteger() {
+		return values[readSlot++].integer;
+	}
+
+	uint16_t nextDeci() {
+		return values[readSlot++].deci;
+	}
+
+	char nextCharacter() {
+		return values[readSlot++].character;
+	}
+
+private:
+	union Value {
+		int8_t token;
+		int32_t integer;
+		uint16_t deci;
+		char character;
+	};
+
+	static constexpr uint8_t countFields(StateFieldMask mask) {
+		return mask == 0 ? 0 : (mask & 1) + countFields(mask >> 1);
+	}
+
+	static constexpr uint8_t SLOTS_COUNT = countFields(FIELDS) > 0 ? countFields(FIELDS) : 1;
+
+	static uint8_t getNextField(uint8_t from) {
+		while (from < (uint8_t)StateField::COUNT && !(FIELDS & stateFieldBit((StateField)from))) {
+			from++;
+		}
+		return from;
+	}
+
+	void resetField() {
+		// Every token is a candidate until a character doesn't match
+		value = getStateFieldFormat((StateField)field) == StateFieldFormat::TOKEN ? 0xFF : 0;
+		length = 0;
+		decimals = -1;
+		negative = false;
+		started = false;
+		ended = false;
+	}
+
+	// Drop the tokens not having c at this position, whatever is left when the field ends is compared
+	// in full. value is the bitmap of the candidates
+	void feedToken(char c) {
+		const char *token = getStateFieldTokens((StateField)field);
+
+		for (uint8_t i = 0; pgm_read_byte(token) != '\0'; i++) {
+			if ((value & (1 << i)) && (c == '\0' || pgm_read_byte(token + length) != c)) {
+				value &= ~(1 << i);
+			}
+			token += strlen_P(token) + 1;
+		}
+
+		if (length < 0xFF) {
+			length++;
+		}
+	}
+
+	// Like String::toInt(), the number ends at the first character that doesn't belong to it
+	void feedInteger(char c) {
+		if (ended) {
+			return;
+		}
+
+		if (c >= '0' && c <= '9') {
+			if (value < 100000000) {
+				value = value * 10 + (c - '0');
+			}
+			started = true;
+		} else if (c == '-' && !started) {
+			negative = true;
+			started = true;
+		} else if (c != ' ' || started) {
+			ended = true;
+		}
+	}
+
+	// Tenths, rounded with the hundredths. ',' is a decimal separator too
+	void feedDeci(char c) {
+		if (c == '-') {
+			negative = true;
+		} else if ((c == '.' || c == ',') && decimals < 0) {
+			decimals = 0;
+		} else if (c >= '0' && c <= '9' && decimals < 2) {
+			if (decimals < 1) {
+				if (value < 0xFFFF) {
+					value = value * 10 + (c - '0');
+				}
+			} else if (c >= '5') {
+				value++;
+			}
+			if (decimals >= 0) {
+				decimals++;
+			}
+		}
+	}
+
+	// The candidate that ends here, the only one matching every character
+	int8_t matchToken() const {
+		const char *token = getStateFieldTokens((StateField)field);
+
+		for (uint8_t i = 0; pgm_read_byte(token) != '\0'; i++) {
+			uint8_t tokenLength = strlen_P(token);
+			if ((value & (1 << i)) && tokenLength == length) {
+				return i;
+			}
+			token += tokenLength + 1;
+		}
+
+		return -1;
+	}
+
+	void completeField() {
+		Value &slot = values[writeSlot++];
+
+		switch (getStateFieldFormat((StateField)field)) {
+			case StateFieldFormat::TOKEN:
+				slot.token = matchToken();
+				break;
+			case StateFieldFormat::INTEGER:
+				slot.integer = negative ? -(int32_t)value : (int32_t)value;
+				break;
+			case StateFieldFormat::DECI:
+				// Negative numbers read as 0, too big ones as 0xFFFF
+				if (negative) {
+					value = 0;
+				} else if (decimals < 1) {
+					value *= 10;
+				}
+				slot.deci = value > 0xFFFF ? 0xFFFF : value;
+				break;
+			case StateFieldFormat::CHARACTER:
+				slot.character = value;
+				break;
+		}
+
+		field = getNextField(field + 1);
+		resetField();
+	}
+
+	Value values[SLOTS_COUNT];
+	uint8_t writeSlot = 0;
+	uint8_t readSlot = 0;
+
+	/**
+	 * The field being parsed, StateField::COUNT when not parsing.
+	 */
+	uint8_t field = (uint8_t)StateField::COUNT;
+
+	uint32_t value = 0;
+	uint8_t length = 0;
+	int8_t decimals = -1;
+	bool negative = false;
+	bool started = false;
+	bool ended = false;
+};
@@ -0,0 +1,33 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "NeedleSmoother.h"
+
+constexpr uint16_t NeedleSmoother::MAX_INTERVAL_MS;
+
+void NeedleSmoother::setTarget(int value, uint32_t timeMs) {
+	uint32_t elapsedMs = timeMs - startTimeMs;
+
+	if (!anyTarget || elapsedMs > MAX_INTERVAL_MS) {
+		startValue = value;
+	} else {
+		startValue = getValue(timeMs);
+		intervalMs = (intervalMs * 3 + elapsedMs) / 4;
+	}
+
+	anyTarget = true;
+	targetValue = value;
+	startTimeMs = timeMs;
+}
+
+int NeedleSmoother::getValue(uint32_t timeMs) const {
+	uint32_t elapsedMs = timeMs - startTimeMs;
+
+	if (elapsedMs >= intervalMs) {
+		return targetValue;
+	}
+
+	return startValue + (int32_t)(targetValue - startValue) * (int32_t)elapsedMs / intervalMs;
+}
@@ -0,0 +1,57 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Gauge value interpolator.
+ *
+ * SimHub updates come at an uneven rate, slower than the gauge frames are sent, so sending the last
+ * value as is makes the needles step. Instead, every new value is reached linearly from the one
+ * being shown, over the average time between updates.
+ *
+ * The needles only get the intermediate values if the gauge frame is sent often enough: the
+ * clusters having it send their 8 bytes RPM and speed frame (0x0B6) every 20 ms, 111 to 135 bits
+ * depending on the bit stuffing, 4.4% to 5.4% of a 125 kbps bus.
+ *
+ * Ramping toward the last value received, instead of extrapolating past it, never overshoots but
+ * reaches each value about one update interval after SimHub sent it, the needles lag the game by
+ * that much (e.g. 100 ms at 10 updates per second) on top of the serial and CAN latency.
+ */
+class NeedleSmoother {
+public:
+	/**
+	 * Set the last value received.
+	 *
+	 * @param value The value
+	 * @param timeMs millis() when it has been received
+	 */
+	void setTarget(int value, uint32_t timeMs);
+
+	/**
+	 * @param timeMs millis()
+	 * @return The value to be shown
+	 */
+	int getValue(uint32_t timeMs) const;
+
+private:
+	/**
+	 * Updates further apart than this are considered a pause and jumped to directly.
+	 */
+	static constexpr uint16_t MAX_INTERVAL_MS = 500;
+
+	int startValue = 0;
+	int targetValue = 0;
+	uint32_t startTimeMs = 0;
+
+	bool anyTarget = false;
+
+	/**
+	 * Moving average of the time between updates.
+	 */
+	uint16_t intervalMs = 100;
+};
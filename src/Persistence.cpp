@@ -0,0 +1,118 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "Persistence.h"
+
+#include <avr/eeprom.h>
+#include <stddef.h>
+#include <util/crc16.h>
+
+constexpr uint16_t Persistence::EEPROM_OFFSET;
+constexpr uint8_t Persistence::SLOTS_COUNT;
+constexpr uint8_t Persistence::SAVE_EVERY_KM;
+constexpr uint16_t Persistence::ERASED_SEQUENCE;
+
+PersistedState Persistence::record = {};
+uint8_t Persistence::nextSlot = 0;
+uint8_t Persistence::writtenBytes = sizeof(PersistedState);
+bool Persistence::saveRequested = false;
+
+void Persistence::restore(State &state) {
+	static_assert(EEPROM_OFFSET + SLOTS_COUNT * sizeof(PersistedState) <= E2END + 1,
+		"The persistence ring doesn't fit in the EEPROM");
+
+	bool found = false;
+
+	for (uint8_t slot = 0; slot < SLOTS_COUNT; slot++) {
+		PersistedState candidate;
+		eeprom_read_block(&candidate, getSlotAddress(slot), sizeof(candidate));
+
+		if (candidate.sequence == ERASED_SEQUENCE || candidate.crc != computeCrc(candidate)) {
+			continue;
+		}
+
+		// The sequence wraps around, but the records in the ring are never more than SLOTS_COUNT apart
+		if (found && (int16_t)(candidate.sequence - record.sequence) <= 0) {
+			continue;
+		}
+
+		found = true;
+		record = candidate;
+		nextSlot = (slot + 1) % SLOTS_COUNT;
+	}
+
+	if (!found) {
+		return;
+	}
+
+	state.odometerKm = record.odometerKm;
+	state.serviceCounterKm = record.serviceCounterKm;
+	state.lastTrip = record.lastTrip;
+}
+
+void Persistence::update(const State &state) {
+	if (writtenBytes < sizeof(record)) {
+		// Each byte takes ~3.3 ms to be written, don't wait for it
+		const uint8_t *data = (const uint8_t *)&record;
+		uint8_t *address = getSlotAddress(nextSlot);
+		while (writtenBytes < sizeof(record) && eeprom_is_ready()) {
+			eeprom_update_byte(address + writtenBytes, data[writtenBytes]);
+			writtenBytes++;
+		}
+
+		if (writtenBytes == sizeof(record)) {
+			nextSlot = (nextSlot + 1) % SLOTS_COUNT;
+		}
+
+		return;
+	}
+
+	bool distanceDue = state.odometerKm >= record.odometerKm + SAVE_EVERY_KM;
+	if (!distanceDue && !(saveRequested && isChanged(state))) {
+		saveRequested = false;
+		return;
+	}
+
+	saveRequested = false;
+
+	record.sequence++;
+	if (record.sequence == ERASED_SEQUENCE) {
+		record.sequence = 0;
+	}
+	record.odometerKm = state.odometerKm;
+	record.serviceCounterKm = state.serviceCounterKm;
+	record.lastTrip = state.lastTrip;
+	record.crc = computeCrc(record);
+
+	writtenBytes = 0;
+}
+
+void Persistence::requestSave() {
+	saveRequested = true;
+}
+
+uint8_t Persistence::computeCrc(const PersistedState &record) {
+	const uint8_t *data = (const uint8_t *)&record;
+	uint8_t crc = 0;
+
+	for (uint8_t i = 0; i < offsetof(PersistedState, crc); i++) {
+		crc = _crc8_ccitt_update(crc, data[i]);
+	}
+
+	return crc;
+}
+
+bool Persistence::isChanged(const State &state) {
+	return state.odometerKm != record.odometerKm
+		|| state.serviceCounterKm != record.serviceCounterKm
+		|| state.lastTrip.averageSpeedKmh != record.lastTrip.averageSpeedKmh
+		|| state.lastTrip.distanceMeters != record.lastTrip.distanceMeters
+		|| state.lastTrip.averageFuelConsumptionDeciLP100Km != record.lastTrip.averageFuelConsumptionDeciLP100Km
+		|| state.lastTrip.durationMinutes != record.lastTrip.durationMinutes;
+}
+
+uint8_t *Persistence::getSlotAddress(uint8_t slot) {
+	return (uint8_t *)(EEPROM_OFFSET + slot * sizeof(PersistedState));
+}
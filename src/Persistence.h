@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "types.h"
+
+/**
+ * State fields surviving a restart, as stored in EEPROM.
+ */
+struct PersistedState {
+	/**
+	 * Incremented on every save, the valid record with the highest one is the current one.
+	 */
+	uint16_t sequence;
+
+	uint32_t odometerKm;
+	uint16_t serviceCounterKm;
+	Trip lastTrip;
+
+	/**
+	 * CRC8 of all the fields above.
+	 */
+	uint8_t crc;
+};
+
+/**
+ * Wear-leveled EEPROM storage of the odometer, the service counter and the last trip.
+ *
+ * Every save goes to the next slot of a ring, so each EEPROM cell is only written once every
+ * SLOTS_COUNT saves. Saves are coalesced, happening every SAVE_EVERY_KM km or when requested with
+ * something changed, and written a byte at a time without waiting for the EEPROM, so they never
+ * stall the loop. A save interrupted by a reset fails its CRC and the previous one is used instead.
+ */
+class Persistence {
+public:
+	/**
+	 * Load the last saved values into the state, if any.
+	 */
+	static void restore(State &state);
+
+	/**
+	 * Save the state if due and carry on with the pending save, to be called on every loop.
+	 */
+	static void update(const State &state);
+
+	/**
+	 * Save the state on the next update() if anything changed, e.g. on shutdown.
+	 */
+	static void requestSave();
+
+private:
+	static uint8_t computeCrc(const PersistedState &record);
+
+	static bool isChanged(const State &state);
+
+	static uint8_t *getSlotAddress(uint8_t slot);
+
+	static constexpr uint16_t EEPROM_OFFSET = 0;
+	static constexpr uint8_t SLOTS_COUNT = 32;
+	static constexpr uint8_t SAVE_EVERY_KM = 5;
+
+	/**
+	 * Sequence of a blank slot, never used by a record.
+	 */
+	static constexpr uint16_t ERASED_SEQUENCE = 0xFFFF;
+
+	/**
+	 * The last record saved, or being saved.
+	 */
+	static PersistedState record;
+
+	static uint8_t nextSlot;
+
+	/**
+	 * Bytes of record already written, sizeof(record) when there's no save in progress.
+	 */
+	static uint8_t writtenBytes;
+
+	static bool saveRequested;
+};
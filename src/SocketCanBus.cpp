@@ -0,0 +1,159 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "SocketCanBus.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <fcntl.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * Maximum number of IDs accepted by setReceiveFilters(), the others are ignored.
+ */
+static constexpr uint8_t maxFilters = 32;
+
+SocketCanBus::SocketCanBus(const char *interfaceName) : interfaceName(interfaceName) {}
+
+SocketCanBus::~SocketCanBus() {
+	if (socketFd >= 0) {
+		close(socketFd);
+	}
+}
+
+void SocketCanBus::setup(uint32_t bitrate) {
+	(void)bitrate;
+
+	if (socketFd >= 0) {
+		return;
+	}
+
+	socketFd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (socketFd < 0) {
+		perror("SocketCanBus: socket");
+		return;
+	}
+
+	struct ifreq ifr = {};
+	strncpy(ifr.ifr_name, interfaceName, IFNAMSIZ - 1);
+	if (ioctl(socketFd, SIOCGIFINDEX, &ifr) < 0) {
+		perror("SocketCanBus: SIOCGIFINDEX");
+		close(socketFd);
+		socketFd = -1;
+		return;
+	}
+
+	struct sockaddr_can addr = {};
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	if (bind(socketFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("SocketCanBus: bind");
+		close(socketFd);
+		socketFd = -1;
+		return;
+	}
+
+	// Same as the MCP2515, nothing is accepted until asked to
+	setReceiveFilters(nullptr, 0);
+
+	int enable = 1;
+	setsockopt(socketFd, SOL_SOCKET, SO_TIMESTAMP, &enable, sizeof(enable));
+
+	fcntl(socketFd, F_SETFL, fcntl(socketFd, F_GETFL) | O_NONBLOCK);
+}
+
+bool SocketCanBus::sendMessage(const struct can_frame *frame) {
+	if (socketFd < 0) {
+		return false;
+	}
+
+	return write(socketFd, frame, sizeof(*frame)) == sizeof(*frame);
+}
+
+void SocketCanBus::setReceiveFilters(const canid_t *ids, uint8_t count) {
+	if (socketFd < 0) {
+		return;
+	}
+
+	struct can_filter filters[maxFilters];
+	if (count > maxFilters) {
+		count = maxFilters;
+	}
+
+	for (uint8_t i = 0; i < count; i++) {
+		// Standard data frames only
+		filters[i].can_id = ids[i] & CAN_SFF_MASK;
+		filters[i].can_mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+	}
+
+	setsockopt(socketFd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, count * sizeof(filters[0]));
+}
+
+void SocketCanBus::receiveAllMessages() {
+	if (socketFd < 0) {
+		return;
+	}
+
+	struct can_filter filter = {};
+	filter.can_mask = CAN_EFF_FLAG;
+	setsockopt(socketFd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter));
+}
+
+bool SocketCanBus::readMessage(struct can_frame *frame) {
+	if (socketFd < 0) {
+		return false;
+	}
+
+	struct iovec iov = {};
+	iov.iov_base = frame;
+	iov.iov_len = sizeof(*frame);
+
+	char control[CMSG_SPACE(sizeof(struct timeval))];
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(socketFd, &msg, MSG_DONTWAIT) != sizeof(*frame)) {
+		return false;
+	}
+
+	// Frames looped back to their sender are flagged by the kernel
+	lastMessageOwn = (msg.msg_flags & MSG_CONFIRM) != 0;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMP) {
+			memcpy(&lastTimestamp, CMSG_DATA(cmsg), sizeof(lastTimestamp));
+		}
+	}
+
+	return true;
+}
+
+void SocketCanBus::setReceiveOwnMessages(bool enable) {
+	if (socketFd < 0) {
+		return;
+	}
+
+	int value = enable ? 1 : 0;
+	setsockopt(socketFd, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &value, sizeof(value));
+}
+
+const struct timeval &SocketCanBus::getLastTimestamp() const {
+	return lastTimestamp;
+}
+
+bool SocketCanBus::isLastMessageOwn() const {
+	return lastMessageOwn;
+}
+
+#endif
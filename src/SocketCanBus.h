@@ -0,0 +1,72 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <stdint.h>
+#include <sys/time.h>
+#include "CanBus.h"
+
+/**
+ * CAN bus backed by a Linux SocketCAN interface (e.g. vcan0), to run the clusters on a PC.
+ */
+class SocketCanBus : public CanBus {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param interfaceName The SocketCAN interface name, e.g. "vcan0"
+	 */
+	SocketCanBus(const char *interfaceName);
+
+	~SocketCanBus();
+
+	/**
+	 * Open the socket. The bitrate is ignored, it's a property of the interface
+	 * (ip link set can0 type can bitrate 125000).
+	 */
+	void setup(uint32_t bitrate) override;
+
+	bool sendMessage(const struct can_frame *frame) override;
+
+	void setReceiveFilters(const canid_t *ids, uint8_t count) override;
+
+	void receiveAllMessages() override;
+
+	bool readMessage(struct can_frame *frame) override;
+
+	/**
+	 * @return Whether setup() managed to open the interface
+	 */
+	bool isOpen() const {
+		return socketFd >= 0;
+	}
+
+	/**
+	 * Also read back the frames sent on this socket, timestamped by the kernel when they went out,
+	 * e.g. to measure the scheduling jitter. To be called after setup().
+	 */
+	void setReceiveOwnMessages(bool enable);
+
+	/**
+	 * @return The kernel timestamp of the last frame read
+	 */
+	const struct timeval &getLastTimestamp() const;
+
+	/**
+	 * @return Whether the last frame read has been sent on this socket
+	 */
+	bool isLastMessageOwn() const;
+
+private:
+	const char *interfaceName;
+	int socketFd = -1;
+	struct timeval lastTimestamp = {};
+	bool lastMessageOwn = false;
+};
+
+#endif
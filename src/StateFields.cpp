@@ -0,0 +1,77 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "StateFields.h"
+
+#include <avr/pgmspace.h>
+
+static const char temperatureUnitNCalc[] PROGMEM = "+ isnull([DataCorePlugin.GameData.TemperatureUnit], 'Celcius') + ';'";
+static const char pressureUnitNCalc[] PROGMEM = "+ isnull([DataCorePlugin.GameData.OilPressureUnit], 'Bar') + ';'";
+static const char volumeUnitNCalc[] PROGMEM = "+ isnull([DataCorePlugin.GameData.FuelUnit], 'Liters') + ';'";
+static const char speedUnitNCalc[] PROGMEM = "+ isnull([DataCorePlugin.GameData.SpeedLocalUnit], 'KMH') + ';'";
+static const char ignitionNCalc[] PROGMEM = "+ isnull([DataCorePlugin.GameData.EngineIgnitionOn], '1') + ';'";
+static const char engineStartedNCalc[] PROGMEM = "+ isnull([DataCorePlugin.GameData.EngineStarted], '1') + ';'";
+static const char rpmNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.Rpms], '0') + ';'";
+static const char speedNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.SpeedKmh], '0') + ';'";
+static const char coolantTemperatureNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.WaterTemperature], '0') + ';'";
+static const char ambientTemperatureNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.AirTemperature], '0') + ';'";
+static const char fuelLevelNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.FuelPercent], '0') + ';'";
+static const char odometerNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.SessionOdo], '0') + ';'";
+static const char instantFuelConsumptionNCalc[] PROGMEM = "+ isnull([DataCorePlugin.GameData.InstantConsumption_L100KM], '0') + ';'";
+static const char gearNCalc[] PROGMEM = "+ isnull([DataCorePlugin.GameData.Gear], 'N') + ';'";
+static const char leftIndicatorNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.TurnIndicatorLeft], '0') + ';'";
+static const char rightIndicatorNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.TurnIndicatorRight], '0') + ';'";
+// The current TC and ABS state, SHCustomProtocol keeps them active for FEATURE_ACTIVE_HOLD_MS
+static const char tcActiveNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.TCActive], '0') + ';'";
+static const char absActiveNCalc[] PROGMEM = "+ format([DataCorePlugin.GameData.ABSActive], '0') + ';'";
+
+static const char *const stateFieldsNCalc[] PROGMEM = {
+	temperatureUnitNCalc,
+	pressureUnitNCalc,
+	volumeUnitNCalc,
+	speedUnitNCalc,
+	ignitionNCalc,
+	engineStartedNCalc,
+	rpmNCalc,
+	speedNCalc,
+	coolantTemperatureNCalc,
+	ambientTemperatureNCalc,
+	fuelLevelNCalc,
+	odometerNCalc,
+	instantFuelConsumptionNCalc,
+	gearNCalc,
+	leftIndicatorNCalc,
+	rightIndicatorNCalc,
+	tcActiveNCalc,
+	absActiveNCalc,
+};
+
+static_assert(sizeof(stateFieldsNCalc) / sizeof(stateFieldsNCalc[0]) == (uint8_t)StateField::COUNT,
+	"Every field needs its NCalc expression");
+
+const char *getStateFieldNCalc(StateField field) {
+	return (const char *)pgm_read_ptr(&stateFieldsNCalc[(uint8_t)field]);
+}
+
+// In the order of TemperatureUnit, PressureUnit, VolumeUnit and DistanceUnit
+static const char temperatureUnitTokens[] PROGMEM = "Celcius\0Fahrenheit\0Kelvin\0";
+static const char pressureUnitTokens[] PROGMEM = "Bar\0Kpa\0Psi\0";
+static const char volumeUnitTokens[] PROGMEM = "Liters\0Gallons\0";
+static const char speedUnitTokens[] PROGMEM = "KMH\0MPH\0";
+
+const char *getStateFieldTokens(StateField field) {
+	switch (field) {
+		case StateField::TEMPERATURE_UNIT:
+			return temperatureUnitTokens;
+		case StateField::PRESSURE_UNIT:
+			return pressureUnitTokens;
+		case StateField::VOLUME_UNIT:
+			return volumeUnitTokens;
+		case StateField::SPEED_UNIT:
+			return speedUnitTokens;
+		default:
+			return nullptr;
+	}
+}
@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * The fields of the SimHub custom protocol message, in the order they're sent.
+ */
+enum class StateField : uint8_t {
+	TEMPERATURE_UNIT = 0,
+	PRESSURE_UNIT = 1,
+	VOLUME_UNIT = 2,
+	SPEED_UNIT = 3,
+	IGNITION = 4,
+	ENGINE_STARTED = 5,
+	RPM = 6,
+	SPEED = 7,
+	COOLANT_TEMPERATURE = 8,
+	AMBIENT_TEMPERATURE = 9,
+	FUEL_LEVEL = 10,
+	ODOMETER = 11,
+	INSTANT_FUEL_CONSUMPTION = 12,
+	GEAR = 13,
+	LEFT_INDICATOR = 14,
+	RIGHT_INDICATOR = 15,
+	TC_ACTIVE = 16,
+	ABS_ACTIVE = 17,
+
+	COUNT,
+};
+
+/**
+ * A set of StateField, one bit each.
+ */
+typedef uint32_t StateFieldMask;
+
+static_assert((uint8_t)StateField::COUNT <= sizeof(StateFieldMask) * 8, "StateFieldMask is too small");
+
+constexpr StateFieldMask stateFieldBit(StateField field) {
+	return (StateFieldMask)1 << (uint8_t)field;
+}
+
+/**
+ * Locale.
+ */
+constexpr StateFieldMask LOCALE_FIELDS = stateFieldBit(StateField::TEMPERATURE_UNIT)
+	| stateFieldBit(StateField::PRESSURE_UNIT)
+	| stateFieldBit(StateField::VOLUME_UNIT)
+	| stateFieldBit(StateField::SPEED_UNIT);
+
+/**
+ * Headlights.
+ */
+constexpr StateFieldMask INDICATORS_FIELDS = stateFieldBit(StateField::LEFT_INDICATOR)
+	| stateFieldBit(StateField::RIGHT_INDICATOR);
+
+/**
+ * Trip::distanceMeters and Trip::durationMinutes, computed by the trip computer.
+ */
+constexpr StateFieldMask TRIP_DISTANCE_FIELDS = stateFieldBit(StateField::ENGINE_STARTED)
+	| stateFieldBit(StateField::SPEED);
+
+/**
+ * Everything computed by the trip computer, including the averages and the range.
+ */
+constexpr StateFieldMask TRIP_COMPUTER_FIELDS = TRIP_DISTANCE_FIELDS
+	| stateFieldBit(StateField::FUEL_LEVEL)
+	| stateFieldBit(StateField::INSTANT_FUEL_CONSUMPTION);
+
+/**
+ * How a field is encoded in the message.
+ */
+enum class StateFieldFormat : uint8_t {
+	/**
+	 * A unit name, one of getStateFieldTokens().
+	 */
+	TOKEN,
+	/**
+	 * An integer, possibly negative.
+	 */
+	INTEGER,
+	/**
+	 * A decimal number, in tenths.
+	 */
+	DECI,
+	/**
+	 * Only the first character matters.
+	 */
+	CHARACTER,
+};
+
+constexpr StateFieldFormat getStateFieldFormat(StateField field) {
+	return stateFieldBit(field) & LOCALE_FIELDS ? StateFieldFormat::TOKEN
+		: field == StateField::INSTANT_FUEL_CONSUMPTION ? StateFieldFormat::DECI
+		: field == StateField::GEAR ? StateFieldFormat::CHARACTER
+		: StateFieldFormat::INTEGER;
+}
+
+/**
+ * @return The SimHub NCalc expression of the field, in PROGMEM
+ */
+const char *getStateFieldNCalc(StateField field);
+
+/**
+ * @return The names a TOKEN field can take, in PROGMEM, each one '\0' terminated and the last one
+ *         followed by an empty one. Their order is the one of the matching enum (e.g.
+ *         TemperatureUnit), at most 8 names
+ */
+const char *getStateFieldTokens(StateField field);
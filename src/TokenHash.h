@@ -0,0 +1,30 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Hash of a short string token (djb2 xor variant, 16 bits), to decode tokens with a switch instead
+ * of string comparisons.
+ *
+ * The hash can be computed a character at a time while reading, and at compile time with
+ * tokenHash() for the case labels. Two tokens of the same switch hashing the same are duplicate
+ * case labels, so a switch over the known tokens is guaranteed to be collision-free at compile
+ * time. Unknown tokens may still hash like a known one, so a case must compare the token with its
+ * name before acting on it.
+ */
+typedef uint16_t TokenHash;
+
+constexpr TokenHash TOKEN_HASH_SEED = 5381;
+
+constexpr TokenHash tokenHashUpdate(TokenHash hash, char c) {
+	return (TokenHash)(hash * 33) ^ (uint8_t)c;
+}
+
+constexpr TokenHash tokenHash(const char *token, TokenHash hash = TOKEN_HASH_SEED) {
+	return *token == '\0' ? hash : tokenHash(token + 1, tokenHashUpdate(hash, *token));
+}
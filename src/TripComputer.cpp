@@ -0,0 +1,101 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "TripComputer.h"
+
+constexpr uint16_t TripComputer::MAX_STEP_MS;
+constexpr uint16_t TripComputer::MAX_CONSUMPTION_DECI_LP100KM;
+constexpr uint16_t TripComputer::MIN_RANGE_DISTANCE_METERS;
+
+void TripComputer::update(State &state, uint32_t timeMs, uint8_t tankCapacityLiters) {
+	uint32_t elapsedMs = timeMs - lastUpdateMs;
+
+	this->tankCapacityLiters = tankCapacityLiters;
+	bool integrate = anyUpdate && elapsedMs <= MAX_STEP_MS && state.engineStarted;
+
+	anyUpdate = true;
+	lastUpdateMs = timeMs;
+
+	if (!integrate || elapsedMs == 0) {
+		return;
+	}
+
+	bool changed = false;
+
+	durationRemainderMs += elapsedMs;
+	if (durationRemainderMs >= 1000) {
+		durationSeconds += durationRemainderMs / 1000;
+		durationRemainderMs %= 1000;
+		changed = true;
+	}
+
+	if (state.speedKmh > 0) {
+		uint32_t distanceIncrement = (uint32_t)state.speedKmh * elapsedMs;
+
+		uint16_t consumptionDeciLP100Km = state.instantFuelConsumptionDeciLP100Km < MAX_CONSUMPTION_DECI_LP100KM
+			? state.instantFuelConsumptionDeciLP100Km
+			: MAX_CONSUMPTION_DECI_LP100KM;
+
+		distanceRemainder += distanceIncrement;
+		if (distanceRemainder >= 3600) {
+			distanceMeters += distanceRemainder / 3600;
+			distanceRemainder %= 3600;
+			changed = true;
+		}
+
+		fuelRemainder += distanceIncrement * consumptionDeciLP100Km;
+		if (fuelRemainder >= 3600) {
+			fuelMicroliters += fuelRemainder / 3600;
+			fuelRemainder %= 3600;
+		}
+	}
+
+	// Divisions are slow, only recompute when something visible changed
+	if (changed) {
+		updateOutputs(state);
+	}
+}
+
+void TripComputer::startNewTrip(State &state) {
+	updateOutputs(state);
+	state.lastTrip = state.currentTrip;
+
+	distanceRemainder = 0;
+	distanceMeters = 0;
+	fuelRemainder = 0;
+	fuelMicroliters = 0;
+	durationRemainderMs = 0;
+	durationSeconds = 0;
+
+	updateOutputs(state);
+}
+
+void TripComputer::clearLastTrip(State &state) {
+	state.lastTrip = {};
+}
+
+void TripComputer::updateOutputs(State &state) {
+	Trip &trip = state.currentTrip;
+
+	trip.distanceMeters = distanceMeters;
+	trip.durationMinutes = durationSeconds / 60;
+
+	// m/s to km/h is 18/5
+	uint32_t averageSpeedKmh = durationSeconds > 0 ? distanceMeters * 18 / (durationSeconds * 5) : 0;
+	trip.averageSpeedKmh = averageSpeedKmh > 0xFF ? 0xFF : averageSpeedKmh;
+
+	// uL/m happens to be tenths of liter per 100 km
+	uint32_t averageConsumptionDeciLP100Km = distanceMeters > 0 ? fuelMicroliters / distanceMeters : 0;
+	trip.averageFuelConsumptionDeciLP100Km = averageConsumptionDeciLP100Km > 0xFFFF ? 0xFFFF : averageConsumptionDeciLP100Km;
+
+	if (distanceMeters >= MIN_RANGE_DISTANCE_METERS && averageConsumptionDeciLP100Km > 0) {
+		// Fuel in the tank in dL, times 100 km
+		uint32_t fuelDl = (uint32_t)state.fuelLevelPercentage * tankCapacityLiters / 10;
+		uint32_t remainingFuelDistanceKm = fuelDl * 100 / averageConsumptionDeciLP100Km;
+		state.remainingFuelDistanceKm = remainingFuelDistanceKm > 0xFFFF ? 0xFFFF : remainingFuelDistanceKm;
+	} else {
+		state.remainingFuelDistanceKm = 0;
+	}
+}
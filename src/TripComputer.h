@@ -0,0 +1,79 @@
+/*
+ * SPDX-FileCopyrightText: Sebastiano Barezzi
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "types.h"
+
+/**
+ * On-device trip computer.
+ *
+ * The current trip is computed by integrating the speed and the instant fuel consumption over time,
+ * with integer accumulators carrying the sub-meter and sub-microliter remainders so that nothing is
+ * lost between loops. Starting a new trip moves the current one to the last trip.
+ *
+ * Only the range is computed besides the trips, the remaining trip distance needs a destination.
+ */
+class TripComputer {
+public:
+	/**
+	 * Integrate the current speed and consumption and update the current trip and the range. To be
+	 * called only while SimHub is sending data, the time in between is a pause.
+	 *
+	 * @param state The state to read the gauges from and to write the trip to
+	 * @param timeMs millis()
+	 * @param tankCapacityLiters The fuel tank capacity, to compute the range from the fuel level
+	 */
+	void update(State &state, uint32_t timeMs, uint8_t tankCapacityLiters);
+
+	/**
+	 * Move the current trip to the last trip and start a new one.
+	 */
+	void startNewTrip(State &state);
+
+	/**
+	 * Clear the last trip.
+	 */
+	void clearLastTrip(State &state);
+
+private:
+	void updateOutputs(State &state);
+
+	/**
+	 * Updates further apart than this are considered a pause (e.g. SimHub not sending data for a
+	 * while) and not integrated, this also bounds the accumulators increments.
+	 */
+	static constexpr uint16_t MAX_STEP_MS = 500;
+
+	/**
+	 * Idling cars report a huge instant consumption, cap it to the most the clusters can show.
+	 */
+	static constexpr uint16_t MAX_CONSUMPTION_DECI_LP100KM = 999;
+
+	/**
+	 * Range is only computed after this distance, before the average consumption is meaningless.
+	 */
+	static constexpr uint16_t MIN_RANGE_DISTANCE_METERS = 1000;
+
+	bool anyUpdate = false;
+	uint32_t lastUpdateMs = 0;
+	uint8_t tankCapacityLiters = 0;
+
+	/**
+	 * km/h times ms, 1/3600 m.
+	 */
+	uint32_t distanceRemainder = 0;
+	uint32_t distanceMeters = 0;
+
+	/**
+	 * 1/3600 m times tenths of liter per 100 km, 1/3600 uL.
+	 */
+	uint32_t fuelRemainder = 0;
+	uint32_t fuelMicroliters = 0;
+
+	uint16_t durationRemainderMs = 0;
+	uint32_t durationSeconds = 0;
+};
@@ -9,18 +9,81 @@
  * Citroen C5 II cluster manager.
  */
 
+#include "../../CanBus.h"
 #include "../../Cluster.h"
+#include "../../StateFields.h"
 #include "../../types.h"
 #include "commands.h"
 
-void Cluster::setup() {
-	mcp2515.reset();
-	mcp2515.setBitrate(CAN_125KBPS, MCP_8MHZ);
-	mcp2515.setNormalMode();
+class CitroenC5IICluster : public Cluster {
+public:
+	/**
+	 * The State fields updateState() uses, only these are sent by SimHub.
+	 */
+	static constexpr StateFieldMask CONSUMED_FIELDS
+		= stateFieldBit(StateField::IGNITION)
+		| stateFieldBit(StateField::RPM)
+		| stateFieldBit(StateField::SPEED)
+		| stateFieldBit(StateField::COOLANT_TEMPERATURE)
+		| stateFieldBit(StateField::AMBIENT_TEMPERATURE)
+		| stateFieldBit(StateField::ODOMETER)
+		| stateFieldBit(StateField::GEAR)
+		| INDICATORS_FIELDS
+		| stateFieldBit(StateField::TC_ACTIVE)
+		| stateFieldBit(StateField::ABS_ACTIVE)
+		| TRIP_DISTANCE_FIELDS;
+
+	/**
+	 * Fuel tank capacity of the car, set it to your car's for an accurate range.
+	 */
+	static constexpr uint8_t TANK_CAPACITY_LITERS = 71;
+
+	CitroenC5IICluster(CanBus &canBus) : Cluster(canBus) {}
+
+	void setup() override;
+
+	void updateState(State &state) override;
+
+	uint8_t getTankCapacityLiters() const override {
+		return TANK_CAPACITY_LITERS;
+	}
+
+	ExpeditedFrameStatus updateRpmAndSpeed(State &state) override;
+
+	bool isRpmAndSpeedDeferred() const override {
+		return scheduler.rpmAndSpeed.isExpedited();
+	}
+
+private:
+	citroen_c5_ii::Scheduler scheduler;
+};
+
+void CitroenC5IICluster::setup() {
+	canBus.setup(125000);
 }
 
-void Cluster::updateState(State &state) {
+void CitroenC5IICluster::updateState(State &state) {
+	using namespace citroen_c5_ii;
+
+	// Lights blinked by the Arduino toggle as soon as the phase does, not at the next frame
+	uint16_t blinkPhase = BlinkClock::getPhase();
+	if (blinkPhase != scheduler.blinkPhase) {
+		scheduler.blinkPhase = blinkPhase;
+		if (state.driverSeatBeltsStatus == LightStatus::BLINKING
+			|| state.passengerSeatBeltsStatus == LightStatus::BLINKING
+			|| state.rearLeftSeatBeltsStatus == LightStatus::BLINKING
+			|| state.rearCenterSeatBeltsStatus == LightStatus::BLINKING
+			|| state.rearRightSeatBeltsStatus == LightStatus::BLINKING) {
+			scheduler.dashboardLights.expedite();
+		}
+		if (state.highEngineCoolantTemperatureLightStatus == LightStatus::BLINKING) {
+			scheduler.warningLights.expedite();
+		}
+	}
+
 	sendIgnitionAndLighting(
+		canBus,
+		scheduler.ignitionAndLighting,
 		state.economyModeEnabled,
 		state.dashboardLightingEnabled,
 		state.dashboardBrightness,
@@ -28,11 +91,15 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendRpmAndSpeed(
+		canBus,
+		scheduler.rpmAndSpeed,
 		state.rpm,
 		state.speedKmh
 	);
 
 	sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+		canBus,
+		scheduler.ignitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals,
 		state.ignitionState,
 		state.darkModeEnabled,
 		state.engineCoolantTemperatureCelsius,
@@ -43,6 +110,8 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendDashboardLights(
+		canBus,
+		scheduler.dashboardLights,
 		state.passengerSeatBeltsStatus,
 		state.dieselGlowPlugsLight,
 		state.lowFuel,
@@ -63,10 +132,14 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendOilOk(
+		canBus,
+		scheduler.oilOk,
 		state.engineOilLevel
 	);
 
 	sendWarningLights(
+		canBus,
+		scheduler.warningLights,
 		state.parkingBrakeLightStatus,
 		state.engineOilLevel,
 		state.highEngineCoolantTemperatureLightStatus,
@@ -79,11 +152,29 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendTripMeter(
+		canBus,
+		scheduler.tripMeter,
 		state.currentTrip
 	);
 
 	sendServiceLight(
+		canBus,
+		scheduler.serviceLight,
 		state.carServiceStatus,
 		state.serviceCounterKm
 	);
 }
+
+ExpeditedFrameStatus CitroenC5IICluster::updateRpmAndSpeed(State &state) {
+	using namespace citroen_c5_ii;
+
+	scheduler.rpmAndSpeed.expedite();
+	sendRpmAndSpeed(
+		canBus,
+		scheduler.rpmAndSpeed,
+		state.rpm,
+		state.speedKmh
+	);
+
+	return scheduler.rpmAndSpeed.isExpedited() ? ExpeditedFrameStatus::DEFERRED : ExpeditedFrameStatus::SENT;
+}
@@ -5,23 +5,41 @@
 
 #pragma once
 
-#include <mcp2515.h>
 #include <stdint.h>
+#include "../../BlinkClock.h"
+#include "../../CanBus.h"
 #include "../../MessageDebouncer.h"
 #include "../../types.h"
 
-static MCP2515 mcp2515(10);
+namespace citroen_c5_ii {
+
+/**
+ * Message debouncers of a single cluster instance, one per CAN frame.
+ */
+struct Scheduler {
+	MessageDebouncer ignitionAndLighting{100};
+	MessageDebouncer rpmAndSpeed{20, 10};
+	MessageDebouncer ignitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals{500};
+	MessageDebouncer dashboardLights{200};
+	MessageDebouncer oilOk{500};
+	MessageDebouncer warningLights{200};
+	MessageDebouncer tripMeter{200};
+	MessageDebouncer serviceLight{200}; // TODO: Unknown
+	// Blink phase the frames with blinking lights have last been sent in
+	uint16_t blinkPhase = 0;
+};
 
 /**
  * @param brightness 0-15
  */
 static void sendIgnitionAndLighting(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	bool economyModeEnabled,
 	bool dashboardLightingEnabled,
 	uint8_t brightness,
 	IgnitionState ignitionState
 ) {
-	static MessageDebouncer messageDebouncer(100);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -44,14 +62,35 @@ static void sendIgnitionAndLighting(
 	frame.data[6] = 0x00;
 	frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeIgnitionAndLighting(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.economyModeEnabled = frame.data[2] & 0x80;
+	state.dashboardLightingEnabled = frame.data[3] & 0x20;
+	state.dashboardBrightness = frame.data[3] & 0x0F;
+	switch (frame.data[4] & 0x03) {
+		case 0x01:
+			state.ignitionState = IgnitionState::ON;
+			break;
+		case 0x02:
+			state.ignitionState = IgnitionState::OFF;
+			break;
+		default:
+			state.ignitionState = IgnitionState::ACC;
+			break;
+	}
 }
 
 static void sendRpmAndSpeed(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	int rpm,
 	int speedKmh
 ) {
-	static MessageDebouncer messageDebouncer(50);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -72,10 +111,23 @@ static void sendRpmAndSpeed(
 	frame.data[6] = 0x00; // Fuel consumption (Does nothing)
 	frame.data[7] = 0x00; // Does nothing
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeRpmAndSpeed(
+	const struct can_frame &frame,
+	State &state
+) {
+	uint16_t rpmData = (uint16_t)frame.data[0] << 8 | frame.data[1];
+	uint16_t speedData = (uint16_t)frame.data[2] << 8 | frame.data[3];
+
+	state.rpm = rpmData >> 3;
+	state.speedKmh = speedData / 100;
 }
 
 static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	IgnitionState ignitionState,
 	bool darkModeEnabled,
 	int engineCoolantTemperatureCelsius,
@@ -84,7 +136,6 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 	Headlights &headlights,
 	Gear gear
 ) {
-	static MessageDebouncer messageDebouncer(500);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -95,11 +146,11 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 	if (engineCoolantTemperatureCelsius <= 90) {
 		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 130) / 2;
 	} else if (engineCoolantTemperatureCelsius <= 100) {
-		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius - 62.5) * 4;
+		engineCoolantTemperatureData = engineCoolantTemperatureCelsius * 4 - 250;
 	} else if (engineCoolantTemperatureCelsius <= 110) {
 		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 200) / 2;
 	} else if (engineCoolantTemperatureCelsius <= 130) {
-		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 946) / 6.7;
+		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 946) * 10 / 67; // / 6.7
 	} else {
 		engineCoolantTemperatureData = 160; // Clamp to 130 °C
 	}
@@ -124,10 +175,46 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 		| (headlights.rightIndicator ? 0x02 : 0x00) // Bit 1: Turn right
 		| (headlights.leftIndicator ? 0x01 : 0x00); // Bit 0: Turn left
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+	const struct can_frame &frame,
+	State &state
+) {
+	// The lowest temperature of each step, the one the cluster starts showing it at
+	uint8_t engineCoolantTemperatureData = frame.data[1];
+	if (engineCoolantTemperatureData <= 110) {
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureData * 2 - 130;
+	} else if (engineCoolantTemperatureData <= 150) {
+		state.engineCoolantTemperatureCelsius = (engineCoolantTemperatureData + 250) / 4;
+	} else if (engineCoolantTemperatureData <= 155) {
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureData * 2 - 200;
+	} else {
+		// Rounded up, the first whole degree of the 6.7 °C step
+		int16_t engineCoolantTemperatureCelsius = (engineCoolantTemperatureData * 67 - 9460 + 9) / 10;
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureCelsius < 111 ? 111 : engineCoolantTemperatureCelsius;
+	}
+
+	uint32_t odometerData = (uint32_t)frame.data[2] << 16 | (uint32_t)frame.data[3] << 8 | frame.data[4];
+
+	// Ignition is taken from 0x036, which tells OFF and ACC apart
+	state.darkModeEnabled = frame.data[0] & 0x10;
+	state.odometerKm = odometerData / 10;
+	// The data of temperatures below 79 °C wraps around below 0
+	state.ambientTemperatureCelsius = (int8_t)frame.data[5] * 2 + 79;
+	if (frame.data[7] & 0x80) {
+		state.gear = Gear::GEAR_R;
+	} else if (state.gear == Gear::GEAR_R) {
+		state.gear = Gear::GEAR_HIDDEN;
+	}
+	state.headlights.rightIndicator = frame.data[7] & 0x02;
+	state.headlights.leftIndicator = frame.data[7] & 0x01;
 }
 
 static void sendDashboardLights(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	LightStatus passengerSeatBeltsStatus,
 	bool dieselGlowPlugsLight,
 	bool lowFuel,
@@ -146,7 +233,6 @@ static void sendDashboardLights(
 	bool autoGearSelection,
 	bool sportMode
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -214,11 +300,11 @@ static void sendDashboardLights(
 	frame.can_id = 0x128; // 0x928 is also accepted
 	frame.can_dlc = 8;
 	frame.data[0] = 0x00
-		| (driverSeatBeltsStatus != LightStatus::OFF ? 0x40 : 0x00) // Bit 6: Driver seat belts
+		| (BlinkClock::isLit(driverSeatBeltsStatus) ? 0x40 : 0x00) // Bit 6: Driver seat belts
 		| (parkingBrakeLightStatus == LightStatus::ON ? 0x20 : 0x00) // Bit 5: Parking brake light
 		| (lowFuel ? 0x10 : 0x00) // Bit 4: Low fuel light
 		| (dieselGlowPlugsLight ? 0x04 : 0x00) // Bit 2: Diesel glow plug light
-		| (passengerSeatBeltsStatus != LightStatus::OFF ? 0x02 : 0x00); // Bit 1: Passenger seat belts
+		| (BlinkClock::isLit(passengerSeatBeltsStatus) ? 0x02 : 0x00); // Bit 1: Passenger seat belts
 	frame.data[1] = 0x00
 		| (serviceWarning ? 0x80 : 0x00) // Bit 7: Service light
 		| (stopWarning ? 0x40 : 0x00); // Bit 6: Stop light on
@@ -235,9 +321,9 @@ static void sendDashboardLights(
 		| (headlights.rightIndicator ? 0x04 : 0x00) // Bit 2: Right indicator
 		| (headlights.leftIndicator ? 0x02 : 0x00); // Bit 1: Left indicator
 	frame.data[5] = 0x00 // TODO: Blinks on 0xF0, 0xE0 and 0x70, it possibly remembers seat belts status
-		| (rearLeftSeatBeltsStatus != LightStatus::OFF ? 0x40 : 0x00) // Bit 6: Rear left seat belts
-		| (rearCenterSeatBeltsStatus != LightStatus::OFF ? 0x10 : 0x00) // Bit 4: Rear center seat belts
-		| (rearRightSeatBeltsStatus != LightStatus::OFF ? 0x04 : 0x00) // Bit 2: Rear right seat belts
+		| (BlinkClock::isLit(rearLeftSeatBeltsStatus) ? 0x40 : 0x00) // Bit 6: Rear left seat belts
+		| (BlinkClock::isLit(rearCenterSeatBeltsStatus) ? 0x10 : 0x00) // Bit 4: Rear center seat belts
+		| (BlinkClock::isLit(rearRightSeatBeltsStatus) ? 0x04 : 0x00) // Bit 2: Rear right seat belts
 		| (automaticParkingBrakeDisabled ? 0x01 : 0x00); // Bit 0: Automatic parking brake disabled
 	frame.data[6] = gearData // Bit 7-4: Gear type (P, R, N, D, 1-6), Bit 3-1: D gear number
 		| (blinkingGear ? 0x01 : 0x00); // Bit 0: Blinking indicator
@@ -246,13 +332,84 @@ static void sendDashboardLights(
 		| (autoGearSelection ? 0x02 : 0x00) // Bit 1: Auto gear selection for automated manual transmission
 		| (gear == Gear::GEAR_HIDDEN ? 0x01 : 0x00); // Bit 0: Hide gear indicator
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static Gear decodeGear(uint8_t gearData) {
+	switch (gearData & 0xFE) {
+		case 0x00:
+			return Gear::GEAR_P;
+		case 0x10:
+			return Gear::GEAR_R;
+		case 0x20:
+			return Gear::GEAR_N;
+		case 0x30:
+			return Gear::GEAR_D;
+		case 0x32:
+			return Gear::GEAR_D_1;
+		case 0x34:
+			return Gear::GEAR_D_2;
+		case 0x36:
+			return Gear::GEAR_D_3;
+		case 0x38:
+			return Gear::GEAR_D_4;
+		case 0x3A:
+			return Gear::GEAR_D_5;
+		case 0x3C:
+			return Gear::GEAR_D_6;
+		case 0x90:
+			return Gear::GEAR_1;
+		case 0x80:
+			return Gear::GEAR_2;
+		case 0x70:
+			return Gear::GEAR_3;
+		case 0x60:
+			return Gear::GEAR_4;
+		case 0x50:
+			return Gear::GEAR_5;
+		case 0x40:
+			return Gear::GEAR_6;
+		default:
+			return Gear::GEAR_HIDDEN;
+	}
+}
+
+[[maybe_unused]] static void decodeDashboardLights(
+	const struct can_frame &frame,
+	State &state
+) {
+	// Parking brake light is taken from 0x168, which has blinking as well
+	state.driverSeatBeltsStatus = frame.data[0] & 0x40 ? LightStatus::ON : LightStatus::OFF;
+	state.lowFuel = frame.data[0] & 0x10;
+	state.dieselGlowPlugsLight = frame.data[0] & 0x04;
+	state.passengerSeatBeltsStatus = frame.data[0] & 0x02 ? LightStatus::ON : LightStatus::OFF;
+	state.serviceWarning = frame.data[1] & 0x80;
+	state.stopWarning = frame.data[1] & 0x40;
+	state.tcStatus = frame.data[2] & 0x10
+		? FeatureStatus::DISABLED
+		: frame.data[2] & 0x08 ? FeatureStatus::ACTIVE : FeatureStatus::ENABLED;
+	state.headlights.sidelights = frame.data[4] & 0x80;
+	state.headlights.lowBeam = frame.data[4] & 0x40;
+	state.headlights.highBeam = frame.data[4] & 0x20;
+	state.headlights.frontFogLights = frame.data[4] & 0x10;
+	state.headlights.rearFogLights = frame.data[4] & 0x08;
+	state.headlights.rightIndicator = frame.data[4] & 0x04;
+	state.headlights.leftIndicator = frame.data[4] & 0x02;
+	state.rearLeftSeatBeltsStatus = frame.data[5] & 0x40 ? LightStatus::ON : LightStatus::OFF;
+	state.rearCenterSeatBeltsStatus = frame.data[5] & 0x10 ? LightStatus::ON : LightStatus::OFF;
+	state.rearRightSeatBeltsStatus = frame.data[5] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.automaticParkingBrakeDisabled = frame.data[5] & 0x01;
+	state.gear = frame.data[7] & 0x01 ? Gear::GEAR_HIDDEN : decodeGear(frame.data[6]);
+	state.blinkingGear = frame.data[6] & 0x01;
+	state.sportMode = frame.data[7] & 0x20;
+	state.autoGearSelection = frame.data[7] & 0x02;
 }
 
 static void sendOilOk(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	EngineOilLevel engineOilLevel
 ) {
-	static MessageDebouncer messageDebouncer(500);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -270,10 +427,24 @@ static void sendOilOk(
 	frame.data[6] = engineOilLevel == EngineOilLevel::UNKNOWN ? 0xFF : 0x00; // 0xFF: Oil reading invalid
 	//frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeOilOk(
+	const struct can_frame &frame,
+	State &state
+) {
+	// Oil level not ok is taken from 0x168
+	if (frame.data[6] == 0xFF) {
+		state.engineOilLevel = EngineOilLevel::UNKNOWN;
+	} else if (state.engineOilLevel == EngineOilLevel::UNKNOWN) {
+		state.engineOilLevel = EngineOilLevel::OK;
+	}
 }
 
 static void sendWarningLights(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	LightStatus parkingBrakeLightStatus,
 	EngineOilLevel engineOilLevel,
 	LightStatus highEngineCoolantTemperatureLightStatus,
@@ -284,7 +455,6 @@ static void sendWarningLights(
 	LightStatus batteryNotChargingLightStatus,
 	bool automaticParkingBrakeIssue
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -294,7 +464,7 @@ static void sendWarningLights(
 	frame.can_id = 0x168; // 0x968 is also accepted
 	frame.can_dlc = 8;
 	frame.data[0] = 0x00
-		| (highEngineCoolantTemperatureLightStatus != LightStatus::OFF ? 0x80 : 0x00) // Bit 7: High engine coolant temperature
+		| (BlinkClock::isLit(highEngineCoolantTemperatureLightStatus) ? 0x80 : 0x00) // Bit 7: High engine coolant temperature
 		| (engineOilLevel == EngineOilLevel::NOT_OK ? 0x10 : 0x00) // Bit 4: Engine oil level not ok
 		| (parkingBrakeLightStatus == LightStatus::ON ? 0x04 : 0x00); // Bit 2: Parking brake light
 	frame.data[1] = 0x00; // Does nothing
@@ -317,13 +487,39 @@ static void sendWarningLights(
 		| (batteryNotChargingLightStatus == LightStatus::BLINKING ? 0x80 : 0x00) // Bit 7: Battery not charging light blink
 		| (checkEngineLightStatus == LightStatus::BLINKING ? 0x40 : 0x00); // Bit 6: Check engine light blink
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeWarningLights(
+	const struct can_frame &frame,
+	State &state
+) {
+	// ESP is taken from 0x128, which has all its states
+	state.highEngineCoolantTemperatureLightStatus = frame.data[0] & 0x80 ? LightStatus::ON : LightStatus::OFF;
+	if (frame.data[0] & 0x10) {
+		state.engineOilLevel = EngineOilLevel::NOT_OK;
+	} else if (state.engineOilLevel == EngineOilLevel::NOT_OK) {
+		state.engineOilLevel = EngineOilLevel::OK;
+	}
+	state.parkingBrakeLightStatus = frame.data[6] & 0x08
+		? LightStatus::BLINKING
+		: frame.data[0] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.absStatus = frame.data[3] & 0x20 ? FeatureStatus::DISABLED : FeatureStatus::ENABLED;
+	state.sportAndWinterGearBlink = frame.data[3] & 0x08;
+	state.checkEngineLightStatus = frame.data[4] & 0x10
+		? LightStatus::BLINKING
+		: frame.data[3] & 0x02 ? LightStatus::ON : LightStatus::OFF;
+	state.batteryNotChargingLightStatus = frame.data[7] & 0x80
+		? LightStatus::BLINKING
+		: frame.data[4] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.automaticParkingBrakeIssue = frame.data[6] & 0x10;
 }
 
 static void sendTripMeter(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Trip &currentTrip
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -341,24 +537,32 @@ static void sendTripMeter(
 	frame.data[6] = currentTrip.distanceMeters >> 8 & 0xFF;
 	frame.data[7] = currentTrip.distanceMeters & 0xFF;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeTripMeter(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.currentTrip.distanceMeters = (uint32_t)frame.data[5] << 16 | (uint32_t)frame.data[6] << 8 | frame.data[7];
 }
 
 /**
  * Not working
  */
 static void sendServiceLight(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	CarServiceStatus carServiceStatus,
 	uint16_t serviceCounterKm
 ) {
-	static MessageDebouncer messageDebouncer(200); // TODO: Unknown
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
 		return;
 	}
 
-	uint16_t counterData = serviceCounterKm / 20.1168;
+	uint16_t counterData = (uint32_t)serviceCounterKm * 625 / 12573; // / 20.1168, steps of 12.5 miles
 
 	frame.can_id = 0x3E7;
 	frame.can_dlc = 8;
@@ -374,5 +578,93 @@ static void sendServiceLight(
 	frame.data[6] = 0x00; // Does nothing
 	frame.data[7] = 0x00; // Does nothing
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeServiceLight(
+	const struct can_frame &frame,
+	State &state
+) {
+	uint16_t counterData = (uint16_t)frame.data[3] << 8 | frame.data[4];
+
+	if (frame.data[0] & 0x28) {
+		state.carServiceStatus = CarServiceStatus::REACHED;
+	} else if (frame.data[0] & 0x10) {
+		state.carServiceStatus = CarServiceStatus::CLOSE;
+	} else {
+		state.carServiceStatus = CarServiceStatus::SAFE;
+	}
+	// Rounded up, the first whole km of the step
+	state.serviceCounterKm = ((uint32_t)counterData * 12573 + 624) / 625;
+}
+
+
+/**
+ * Decode a frame of this cluster back into the state fields it carries, the inverse of the send
+ * functions (up to the resolution of the frame).
+ *
+ * @return true if the frame is known and has been decoded, false otherwise
+ */
+[[maybe_unused]] static bool decodeFrame(
+	const struct can_frame &frame,
+	State &state
+) {
+	if (frame.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG)) {
+		return false;
+	}
+
+	switch (frame.can_id) {
+		case 0x036:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeIgnitionAndLighting(frame, state);
+			return true;
+		case 0x0B6:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeRpmAndSpeed(frame, state);
+			return true;
+		case 0x0F6:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(frame, state);
+			return true;
+		case 0x128:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeDashboardLights(frame, state);
+			return true;
+		case 0x161:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeOilOk(frame, state);
+			return true;
+		case 0x168:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeWarningLights(frame, state);
+			return true;
+		case 0x1A8:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeTripMeter(frame, state);
+			return true;
+		case 0x3E7:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeServiceLight(frame, state);
+			return true;
+		default:
+			return false;
+	}
 }
+
+} // namespace citroen_c5_ii
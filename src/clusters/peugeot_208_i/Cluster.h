@@ -9,38 +9,98 @@
  * Peugeot 208 I cluster manager.
  */
 
+#include "../../CanBus.h"
 #include "../../CanFuzzer.h"
 #include "../../Cluster.h"
+#include "../../StateFields.h"
 #include "../../types.h"
 #include "commands.h"
 
 // Fuzzing
 const canid_t CanFuzzer::startId = 0x400;
 const canid_t CanFuzzer::endId = 0x4FF; //CAN_SFF_MASK;
-const canid_t CanFuzzer::skipIds[] = {
-	0x036,
-	0x0B6,
-	0x0F6,
-	0x128,
-	0x161,
-	0x168,
-	0x1A8,
-	0x3E7,
-	0x3F6,
+constexpr CanIdRange peugeot208ISkipIds[] = {
+	skipCanId(0x036),
+	skipCanId(0x0B6),
+	skipCanId(0x0F6),
+	skipCanId(0x128),
+	skipCanId(0x161),
+	skipCanId(0x168),
+	skipCanId(0x1A8),
+	skipCanId(0x3E7),
+	skipCanId(0x3F6),
 };
-constexpr size_t CanFuzzer::skipIdsSize = sizeof(CanFuzzer::skipIds);
+const uint8_t CanFuzzer::skipIdsBitmap[CanFuzzer::SKIP_BITMAP_SIZE] PROGMEM = CAN_ID_BITMAP(peugeot208ISkipIds);
 
-void Cluster::setup() {
-	mcp2515.reset();
-	mcp2515.setBitrate(CAN_125KBPS, MCP_8MHZ);
-	mcp2515.setNormalMode();
+class Peugeot208ICluster : public Cluster {
+public:
+	/**
+	 * The State fields updateState() uses, only these are sent by SimHub.
+	 */
+	static constexpr StateFieldMask CONSUMED_FIELDS
+		= LOCALE_FIELDS
+		| stateFieldBit(StateField::IGNITION)
+		| stateFieldBit(StateField::RPM)
+		| stateFieldBit(StateField::SPEED)
+		| stateFieldBit(StateField::COOLANT_TEMPERATURE)
+		| stateFieldBit(StateField::AMBIENT_TEMPERATURE)
+		| stateFieldBit(StateField::FUEL_LEVEL)
+		| stateFieldBit(StateField::ODOMETER)
+		| stateFieldBit(StateField::GEAR)
+		| INDICATORS_FIELDS
+		| stateFieldBit(StateField::TC_ACTIVE)
+		| stateFieldBit(StateField::ABS_ACTIVE)
+		| TRIP_DISTANCE_FIELDS;
+
+	/**
+	 * Fuel tank capacity of the car, set it to your car's for an accurate range.
+	 */
+	static constexpr uint8_t TANK_CAPACITY_LITERS = 50;
+
+	Peugeot208ICluster(CanBus &canBus) : Cluster(canBus) {}
+
+	void setup() override;
+
+	void updateState(State &state) override;
+
+	uint8_t getTankCapacityLiters() const override {
+		return TANK_CAPACITY_LITERS;
+	}
+
+	ExpeditedFrameStatus updateRpmAndSpeed(State &state) override;
+
+	bool isRpmAndSpeedDeferred() const override {
+		return scheduler.rpmAndSpeed.isExpedited();
+	}
+
+private:
+	peugeot_208_i::Scheduler scheduler;
+};
+
+void Peugeot208ICluster::setup() {
+	canBus.setup(125000);
 }
 
-void Cluster::updateState(State &state) {
+void Peugeot208ICluster::updateState(State &state) {
+	using namespace peugeot_208_i;
+
+	// Lights blinked by the Arduino toggle as soon as the phase does, not at the next frame
+	uint16_t blinkPhase = BlinkClock::getPhase();
+	if (blinkPhase != scheduler.blinkPhase) {
+		scheduler.blinkPhase = blinkPhase;
+		if (state.highEngineCoolantTemperatureLightStatus == LightStatus::BLINKING
+			|| state.parkingBrakeLightStatus == LightStatus::BLINKING
+			|| state.batteryNotChargingLightStatus == LightStatus::BLINKING) {
+			scheduler.warningLights.expedite();
+		}
+	}
+
 	// Fuzzing
-	//CanFuzzer::fuzzIds(mcp2515);
+	//CanFuzzer::fuzzIds(canBus);
 
 	sendIgnitionAndLighting(
+		canBus,
+		scheduler.ignitionAndLighting,
 		state.economyModeEnabled,
 		state.dashboardLightingEnabled,
 		state.dashboardBrightness,
@@ -48,11 +108,15 @@ void Cluster::updateState(State &state) {
 	);
 
     sendRpmAndSpeed(
+		canBus,
+		scheduler.rpmAndSpeed,
 		state.rpm,
 		state.speedKmh
 	);
 
 	sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+		canBus,
+		scheduler.ignitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals,
 		state.ignitionState,
 		state.darkModeEnabled,
 		state.engineCoolantTemperatureCelsius,
@@ -63,6 +127,8 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendDashboardLights(
+		canBus,
+		scheduler.dashboardLights,
 		state.headlights,
 		state.blinkingGear,
 		state.gear,
@@ -85,12 +151,16 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendFuelAndOil(
+		canBus,
+		scheduler.fuelAndOil,
 		state.engineOilTemperatureCelsius,
 		state.fuelLevelPercentage,
 		state.engineOilLevel
 	);
 
 	sendWarningLights(
+		canBus,
+		scheduler.warningLights,
 		state.parkingBrakeLightStatus,
 		state.engineOilPressureWarning,
 		state.engineOilLevel,
@@ -109,15 +179,35 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendTripMeter(
+		canBus,
+		scheduler.tripMeter,
 		state.currentTrip
 	);
 
 	sendServiceLight(
+		canBus,
+		scheduler.serviceLight,
 		state.carServiceStatus,
 		state.serviceCounterKm
 	);
 
 	sendLocalization(
+		canBus,
+		scheduler.localization,
 		state.locale
 	);
 }
+
+ExpeditedFrameStatus Peugeot208ICluster::updateRpmAndSpeed(State &state) {
+	using namespace peugeot_208_i;
+
+	scheduler.rpmAndSpeed.expedite();
+	sendRpmAndSpeed(
+		canBus,
+		scheduler.rpmAndSpeed,
+		state.rpm,
+		state.speedKmh
+	);
+
+	return scheduler.rpmAndSpeed.isExpedited() ? ExpeditedFrameStatus::DEFERRED : ExpeditedFrameStatus::SENT;
+}
@@ -5,20 +5,39 @@
 
 #pragma once
 
-#include <mcp2515.h>
 #include <stdint.h>
+#include "../../BlinkClock.h"
+#include "../../CanBus.h"
 #include "../../MessageDebouncer.h"
 #include "../../types.h"
 
-static MCP2515 mcp2515(10);
+namespace peugeot_208_i {
+
+/**
+ * Message debouncers of a single cluster instance, one per CAN frame.
+ */
+struct Scheduler {
+	MessageDebouncer ignitionAndLighting{100};
+	MessageDebouncer rpmAndSpeed{20, 10};
+	MessageDebouncer ignitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals{500};
+	MessageDebouncer dashboardLights{200};
+	MessageDebouncer fuelAndOil{500};
+	MessageDebouncer warningLights{200};
+	MessageDebouncer tripMeter{100}; // Should be 200ms, decreasing to fix no data
+	MessageDebouncer serviceLight{200}; // TODO: Unknown
+	MessageDebouncer localization{1000};
+	// Blink phase the frames with blinking lights have last been sent in
+	uint16_t blinkPhase = 0;
+};
 
 static void sendIgnitionAndLighting(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	bool economyModeEnabled,
 	bool dashboardLightingEnabled,
 	uint8_t dashboardBrightness,
 	IgnitionState ignitionState
 ) {
-	static MessageDebouncer messageDebouncer(100);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -41,14 +60,35 @@ static void sendIgnitionAndLighting(
 	frame.data[6] = 0x00;
 	frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeIgnitionAndLighting(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.economyModeEnabled = frame.data[2] & 0x80;
+	state.dashboardLightingEnabled = frame.data[3] & 0x20;
+	state.dashboardBrightness = frame.data[3] & 0x0F;
+	switch (frame.data[4] & 0x03) {
+		case 0x01:
+			state.ignitionState = IgnitionState::ON;
+			break;
+		case 0x02:
+			state.ignitionState = IgnitionState::OFF;
+			break;
+		default:
+			state.ignitionState = IgnitionState::ACC;
+			break;
+	}
 }
 
 static void sendRpmAndSpeed(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	int rpm,
 	int speedKmh
 ) {
-	static MessageDebouncer messageDebouncer(50);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -69,10 +109,23 @@ static void sendRpmAndSpeed(
 	frame.data[6] = 0x00; // Does nothing
 	frame.data[7] = 0x00; // Used for immobilizer, ignore
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeRpmAndSpeed(
+	const struct can_frame &frame,
+	State &state
+) {
+	uint16_t rpmData = (uint16_t)frame.data[0] << 8 | frame.data[1];
+	uint16_t speedData = (uint16_t)frame.data[2] << 8 | frame.data[3];
+
+	state.rpm = rpmData >> 3;
+	state.speedKmh = speedData / 100;
 }
 
 static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	IgnitionState ignitionState,
 	bool darkModeEnabled,
 	int engineCoolantTemperatureCelsius,
@@ -81,7 +134,6 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 	Headlights &headlights,
 	Gear gear
 ) {
-	static MessageDebouncer messageDebouncer(500);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -92,11 +144,11 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 	if (engineCoolantTemperatureCelsius <= 90) {
 		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 130) / 2;
 	} else if (engineCoolantTemperatureCelsius <= 100) {
-		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius - 62.5) * 4;
+		engineCoolantTemperatureData = engineCoolantTemperatureCelsius * 4 - 250;
 	} else if (engineCoolantTemperatureCelsius <= 110) {
 		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 200) / 2;
 	} else if (engineCoolantTemperatureCelsius <= 130) {
-		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 946) / 6.7;
+		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 946) * 10 / 67; // / 6.7
 	} else {
 		engineCoolantTemperatureData = 160; // Clamp to 130 °C
 	}
@@ -120,10 +172,46 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 		| (headlights.rightIndicator ? 0x02 : 0x00) // Bit 1: Turn right
 		| (headlights.leftIndicator ? 0x01 : 0x00); // Bit 0: Turn left
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+	const struct can_frame &frame,
+	State &state
+) {
+	// The lowest temperature of each step, the one the cluster starts showing it at
+	uint8_t engineCoolantTemperatureData = frame.data[1];
+	if (engineCoolantTemperatureData <= 110) {
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureData * 2 - 130;
+	} else if (engineCoolantTemperatureData <= 150) {
+		state.engineCoolantTemperatureCelsius = (engineCoolantTemperatureData + 250) / 4;
+	} else if (engineCoolantTemperatureData <= 155) {
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureData * 2 - 200;
+	} else {
+		// Rounded up, the first whole degree of the 6.7 °C step
+		int16_t engineCoolantTemperatureCelsius = (engineCoolantTemperatureData * 67 - 9460 + 9) / 10;
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureCelsius < 111 ? 111 : engineCoolantTemperatureCelsius;
+	}
+
+	uint32_t odometerData = (uint32_t)frame.data[2] << 16 | (uint32_t)frame.data[3] << 8 | frame.data[4];
+
+	// Ignition is taken from 0x036, which tells OFF and ACC apart
+	state.darkModeEnabled = frame.data[0] & 0x10;
+	state.odometerKm = odometerData / 10;
+	// The data of temperatures below 79 °C wraps around below 0
+	state.ambientTemperatureCelsius = (int8_t)frame.data[5] * 2 + 79;
+	if (frame.data[7] & 0x80) {
+		state.gear = Gear::GEAR_R;
+	} else if (state.gear == Gear::GEAR_R) {
+		state.gear = Gear::GEAR_HIDDEN;
+	}
+	state.headlights.rightIndicator = frame.data[7] & 0x02;
+	state.headlights.leftIndicator = frame.data[7] & 0x01;
 }
 
 static void sendDashboardLights(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Headlights &headlights,
 	bool blinkingGear,
 	Gear gear,
@@ -144,7 +232,6 @@ static void sendDashboardLights(
 	EngineFault engineFault,
 	LightStatus pressClutchLightStatus
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -253,15 +340,108 @@ static void sendDashboardLights(
 		| (pressClutchLightStatus == LightStatus::BLINKING ? 0x20 : 0x00) // Bit 5: Press clutch blink
 		| (pressClutchLightStatus != LightStatus::OFF ? 0x10 : 0x00); // Bit 4: Press clutch light
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static Gear decodeGear(uint8_t gearData) {
+	switch (gearData & 0xFE) {
+		case 0x00:
+			return Gear::GEAR_P;
+		case 0x10:
+			return Gear::GEAR_R;
+		case 0x20:
+			return Gear::GEAR_N;
+		case 0x30:
+			return Gear::GEAR_D;
+		case 0x32:
+			return Gear::GEAR_D_1;
+		case 0x34:
+			return Gear::GEAR_D_2;
+		case 0x36:
+			return Gear::GEAR_D_3;
+		case 0x38:
+			return Gear::GEAR_D_4;
+		case 0x3A:
+			return Gear::GEAR_D_5;
+		case 0x3C:
+			return Gear::GEAR_D_6;
+		case 0x90:
+			return Gear::GEAR_1;
+		case 0x80:
+			return Gear::GEAR_2;
+		case 0x70:
+			return Gear::GEAR_3;
+		case 0x60:
+			return Gear::GEAR_4;
+		case 0x50:
+			return Gear::GEAR_5;
+		case 0x40:
+			return Gear::GEAR_6;
+		default:
+			return Gear::GEAR_HIDDEN;
+	}
+}
+
+[[maybe_unused]] static void decodeDashboardLights(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.headlights.sidelights = frame.data[0] & 0x80;
+	state.headlights.lowBeam = frame.data[0] & 0x40;
+	state.headlights.highBeam = frame.data[0] & 0x20;
+	state.headlights.frontFogLights = frame.data[0] & 0x10;
+	state.headlights.rearFogLights = frame.data[0] & 0x08;
+	state.headlights.rightIndicator = frame.data[0] & 0x04;
+	state.headlights.leftIndicator = frame.data[0] & 0x02;
+	state.gear = decodeGear(frame.data[1]);
+	state.blinkingGear = frame.data[1] & 0x01;
+	state.sportMode = frame.data[2] & 0x20;
+	state.autoGearSelection = frame.data[2] & 0x02;
+	state.serviceWarning = frame.data[3] & 0x80;
+	state.stopWarning = frame.data[3] & 0x40;
+	state.secondPassengerAirbagDisabled = frame.data[3] & 0x10;
+	state.pressBrakePedalLightStatus = frame.data[3] & 0x08
+		? LightStatus::BLINKING
+		: frame.data[3] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.anyDoorOpen = frame.data[4] & 0x40;
+	state.tcStatus = frame.data[4] & 0x04
+		? FeatureStatus::DISABLED
+		: frame.data[4] & 0x02 ? FeatureStatus::ACTIVE : FeatureStatus::ENABLED;
+	state.lowFuel = frame.data[5] & 0x80;
+	state.driverSeatBeltsStatus = frame.data[5] & 0x20
+		? LightStatus::BLINKING
+		: frame.data[5] & 0x40 ? LightStatus::ON : LightStatus::OFF;
+	state.passengerSeatBeltsStatus = frame.data[5] & 0x08
+		? LightStatus::BLINKING
+		: frame.data[5] & 0x10 ? LightStatus::ON : LightStatus::OFF;
+	state.rearLeftSeatBeltsStatus = frame.data[6] & 0x80
+		? LightStatus::BLINKING
+		: frame.data[5] & 0x01 ? LightStatus::ON : LightStatus::OFF;
+	state.rearCenterSeatBeltsStatus = frame.data[6] & 0x20
+		? LightStatus::BLINKING
+		: frame.data[6] & 0x40 ? LightStatus::ON : LightStatus::OFF;
+	state.rearRightSeatBeltsStatus = frame.data[6] & 0x08
+		? LightStatus::BLINKING
+		: frame.data[6] & 0x10 ? LightStatus::ON : LightStatus::OFF;
+	if (frame.data[7] & 0x40) {
+		state.engineFault = EngineFault::MAJOR;
+	} else if (frame.data[7] & 0x80) {
+		state.engineFault = EngineFault::MINOR;
+	} else {
+		state.engineFault = EngineFault::NONE;
+	}
+	state.pressClutchLightStatus = frame.data[7] & 0x20
+		? LightStatus::BLINKING
+		: frame.data[7] & 0x10 ? LightStatus::ON : LightStatus::OFF;
 }
 
 static void sendFuelAndOil(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	int engineOilTemperatureCelsius,
 	uint8_t fuelLevelPercentage,
 	EngineOilLevel engineOilLevel
 ) {
-	static MessageDebouncer messageDebouncer(500);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -281,10 +461,27 @@ static void sendFuelAndOil(
 	frame.data[6] = engineOilLevel == EngineOilLevel::UNKNOWN ? 0xFF : 0x00; // 0xFF: Oil reading invalid
 	//frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeFuelAndOil(
+	const struct can_frame &frame,
+	State &state
+) {
+	// The data of temperatures below 79 °C wraps around below 0
+	state.engineOilTemperatureCelsius = (int8_t)frame.data[2] * 2 + 79;
+	state.fuelLevelPercentage = frame.data[3] == 0xFF ? 0 : frame.data[3];
+	// Oil level not ok is taken from 0x168
+	if (frame.data[6] == 0xFF) {
+		state.engineOilLevel = EngineOilLevel::UNKNOWN;
+	} else if (state.engineOilLevel == EngineOilLevel::UNKNOWN) {
+		state.engineOilLevel = EngineOilLevel::OK;
+	}
 }
 
 static void sendWarningLights(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	LightStatus parkingBrakeLightStatus,
 	bool engineOilPressureWarning,
 	EngineOilLevel engineOilLevel,
@@ -301,7 +498,6 @@ static void sendWarningLights(
 	bool lowBeamWarning,
 	bool waterInFuelFilterWarning
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -311,16 +507,16 @@ static void sendWarningLights(
 	frame.can_id = 0x168;
 	frame.can_dlc = 8;
 	frame.data[0] = 0x00
-		| (highEngineCoolantTemperatureLightStatus != LightStatus::OFF ? 0x80 : 0x00) // Bit 7: High engine coolant temperature
+		| (BlinkClock::isLit(highEngineCoolantTemperatureLightStatus) ? 0x80 : 0x00) // Bit 7: High engine coolant temperature
 		| (engineOilLevel == EngineOilLevel::NOT_OK ? 0x10 : 0x00) // Bit 4: Engine oil level not ok
 		| (engineOilPressureWarning ? 0x08 : 0x00) // Bit 3: Engine oil pressure warning
-		| (parkingBrakeLightStatus == LightStatus::ON ? 0x04 : 0x00); // Bit 2: Parking brake light
+		| (BlinkClock::isLit(parkingBrakeLightStatus) ? 0x04 : 0x00); // Bit 2: Parking brake light
 	frame.data[1] = 0x00
 		| (engineFault == EngineFault::MINOR ? 0x10 : 0x00) // Bit 4: Minor engine fault light
 		| (automaticWipersEnabled ? 0x08 : 0x00); // Bit 3: Automatic wipers enabled
 	frame.data[2] = 0x00
-		| (parkingBrakeLightStatus == LightStatus::ON ? 0x08 : 0x00) // Bit 3: Parking brake light
-		| (batteryNotChargingLightStatus != LightStatus::OFF ? 0x03 : 0x00); // Bit 0-1: Battery not charging light
+		| (BlinkClock::isLit(parkingBrakeLightStatus) ? 0x08 : 0x00) // Bit 3: Parking brake light
+		| (BlinkClock::isLit(batteryNotChargingLightStatus) ? 0x03 : 0x00); // Bit 0-1: Battery not charging light
 	frame.data[3] = 0x00
 		| (absStatus == FeatureStatus::DISABLED ? 0x20 : 0x00) // Bit 5: ABS disabled
 		| (tcStatus == FeatureStatus::DISABLED ? 0x10 : 0x00) // Bit 4: ESP disabled
@@ -336,13 +532,40 @@ static void sendWarningLights(
 	frame.data[6] = 0x00;
 	frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeWarningLights(
+	const struct can_frame &frame,
+	State &state
+) {
+	// Engine fault and ESP are taken from 0x128, which has all their states
+	state.highEngineCoolantTemperatureLightStatus = frame.data[0] & 0x80 ? LightStatus::ON : LightStatus::OFF;
+	if (frame.data[0] & 0x10) {
+		state.engineOilLevel = EngineOilLevel::NOT_OK;
+	} else if (state.engineOilLevel == EngineOilLevel::NOT_OK) {
+		state.engineOilLevel = EngineOilLevel::OK;
+	}
+	state.engineOilPressureWarning = frame.data[0] & 0x08;
+	state.parkingBrakeLightStatus = frame.data[0] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.automaticWipersEnabled = frame.data[1] & 0x08;
+	state.batteryNotChargingLightStatus = frame.data[2] & 0x03 ? LightStatus::ON : LightStatus::OFF;
+	state.absStatus = frame.data[3] & 0x20 ? FeatureStatus::DISABLED : FeatureStatus::ENABLED;
+	state.sportAndWinterGearBlink = frame.data[3] & 0x08;
+	state.waterInFuelFilterWarning = frame.data[4] & 0x80;
+	state.lowBeamWarning = frame.data[4] & 0x40;
+	state.airbagWarning = frame.data[4] & 0x20;
+	state.powerSteeringWarning = frame.data[4] & 0x04;
+	state.startAndStopLightStatus = frame.data[4] & 0x02
+		? LightStatus::BLINKING
+		: frame.data[4] & 0x01 ? LightStatus::ON : LightStatus::OFF;
 }
 
 static void sendTripMeter(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Trip &currentTrip
 ) {
-	static MessageDebouncer messageDebouncer(100); // Should be 200ms, decreasing to fix no data
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -362,21 +585,29 @@ static void sendTripMeter(
 	frame.data[6] = currentTrip.distanceMeters >> 8 & 0xFF;
 	frame.data[7] = currentTrip.distanceMeters & 0xFF;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeTripMeter(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.currentTrip.distanceMeters = (uint32_t)frame.data[5] << 16 | (uint32_t)frame.data[6] << 8 | frame.data[7];
 }
 
 static void sendServiceLight(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	CarServiceStatus carServiceStatus,
 	uint16_t serviceCounterKm
 ) {
-	static MessageDebouncer messageDebouncer(200); // TODO: Unknown
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
 		return;
 	}
 
-	uint16_t counterData = serviceCounterKm / 20.1168;
+	uint16_t counterData = (uint32_t)serviceCounterKm * 625 / 12573; // / 20.1168, steps of 12.5 miles
 
 	frame.can_id = 0x3E7;
 	frame.can_dlc = 8;
@@ -392,13 +623,31 @@ static void sendServiceLight(
 	frame.data[6] = 0x00; // Does nothing
 	frame.data[7] = 0x00; // Does nothing
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeServiceLight(
+	const struct can_frame &frame,
+	State &state
+) {
+	uint16_t counterData = (uint16_t)frame.data[3] << 8 | frame.data[4];
+
+	if (frame.data[0] & 0x28) {
+		state.carServiceStatus = CarServiceStatus::REACHED;
+	} else if (frame.data[0] & 0x10) {
+		state.carServiceStatus = CarServiceStatus::CLOSE;
+	} else {
+		state.carServiceStatus = CarServiceStatus::SAFE;
+	}
+	// Rounded up, the first whole km of the step
+	state.serviceCounterKm = ((uint32_t)counterData * 12573 + 624) / 625;
 }
 
 static void sendLocalization(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Locale &locale
 ) {
-	static MessageDebouncer messageDebouncer(1000);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -533,5 +782,145 @@ static void sendLocalization(
 	frame.data[6] = languageData; // Bit 0-3: Language
 	//frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
 }
+
+[[maybe_unused]] static void decodeLocalization(
+	const struct can_frame &frame,
+	State &state
+) {
+	uint8_t unitsData = frame.data[5];
+	Locale &locale = state.locale;
+
+	locale.timeDisplayMode = unitsData & 0x80 ? TimeDisplayMode::MODE_24_HOUR : TimeDisplayMode::MODE_12_HOUR;
+	locale.temperatureUnit = unitsData & 0x20 ? TemperatureUnit::FAHRENHEIT : TemperatureUnit::CELSIUS;
+	locale.pressureUnit = unitsData & 0x08 ? PressureUnit::PSI : PressureUnit::BAR;
+	locale.consumptionUnit = unitsData & 0x04
+		? ConsumptionUnit::DISTANCE_PER_VOLUME
+		: ConsumptionUnit::VOLUME_PER_DISTANCE;
+	locale.volumeUnit = unitsData & 0x02 ? VolumeUnit::GALLONS : VolumeUnit::LITERS;
+	locale.distanceUnit = unitsData & 0x01 ? DistanceUnit::MILES : DistanceUnit::KILOMETERS;
+
+	switch (frame.data[6] & 0x0F) {
+		case 0x00:
+			locale.language = Language::FRENCH;
+			break;
+		case 0x02:
+			locale.language = Language::GERMAN;
+			break;
+		case 0x03:
+			locale.language = Language::SPANISH;
+			break;
+		case 0x04:
+			locale.language = Language::ITALIAN;
+			break;
+		case 0x05:
+			locale.language = Language::PORTUGUESE;
+			break;
+		case 0x06:
+			locale.language = Language::DUTCH;
+			break;
+		case 0x07:
+			locale.language = Language::GREEK;
+			break;
+		case 0x08:
+			locale.language = Language::BRASILIAN_PORTUGUESE;
+			break;
+		case 0x09:
+			locale.language = Language::POLISH;
+			break;
+		case 0x0A:
+			locale.language = Language::TRADITIONAL_CHINESE;
+			break;
+		case 0x0B:
+			locale.language = Language::SIMPLIFIED_CHINESE;
+			break;
+		case 0x0C:
+			locale.language = Language::TURKISH;
+			break;
+		case 0x0E:
+			locale.language = Language::RUSSIAN;
+			break;
+		case 0x01:
+		default:
+			locale.language = Language::ENGLISH;
+			break;
+	}
+}
+
+
+/**
+ * Decode a frame of this cluster back into the state fields it carries, the inverse of the send
+ * functions (up to the resolution of the frame).
+ *
+ * @return true if the frame is known and has been decoded, false otherwise
+ */
+[[maybe_unused]] static bool decodeFrame(
+	const struct can_frame &frame,
+	State &state
+) {
+	if (frame.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG)) {
+		return false;
+	}
+
+	switch (frame.can_id) {
+		case 0x036:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeIgnitionAndLighting(frame, state);
+			return true;
+		case 0x0B6:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeRpmAndSpeed(frame, state);
+			return true;
+		case 0x0F6:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(frame, state);
+			return true;
+		case 0x128:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeDashboardLights(frame, state);
+			return true;
+		case 0x161:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeFuelAndOil(frame, state);
+			return true;
+		case 0x168:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeWarningLights(frame, state);
+			return true;
+		case 0x1A8:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeTripMeter(frame, state);
+			return true;
+		case 0x3E7:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeServiceLight(frame, state);
+			return true;
+		case 0x3F6:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeLocalization(frame, state);
+			return true;
+		default:
+			return false;
+	}
+}
+
+} // namespace peugeot_208_i
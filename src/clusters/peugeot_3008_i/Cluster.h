@@ -9,18 +9,76 @@
  * '09 Peugeot 3008 manager.
  */
 
+#include "../../CanBus.h"
 #include "../../Cluster.h"
+#include "../../StateFields.h"
 #include "../../types.h"
 #include "commands.h"
 
-void Cluster::setup() {
-	mcp2515.reset();
-	mcp2515.setBitrate(CAN_125KBPS, MCP_8MHZ);
-	mcp2515.setNormalMode();
+class Peugeot3008ICluster : public Cluster {
+public:
+	/**
+	 * The State fields updateState() uses, only these are sent by SimHub.
+	 */
+	static constexpr StateFieldMask CONSUMED_FIELDS
+		= LOCALE_FIELDS
+		| stateFieldBit(StateField::IGNITION)
+		| stateFieldBit(StateField::RPM)
+		| stateFieldBit(StateField::SPEED)
+		| stateFieldBit(StateField::COOLANT_TEMPERATURE)
+		| stateFieldBit(StateField::AMBIENT_TEMPERATURE)
+		| stateFieldBit(StateField::FUEL_LEVEL)
+		| stateFieldBit(StateField::ODOMETER)
+		| stateFieldBit(StateField::GEAR)
+		| INDICATORS_FIELDS
+		| stateFieldBit(StateField::TC_ACTIVE)
+		| stateFieldBit(StateField::ABS_ACTIVE)
+		| TRIP_DISTANCE_FIELDS;
+
+	/**
+	 * Fuel tank capacity of the car, set it to your car's for an accurate range.
+	 */
+	static constexpr uint8_t TANK_CAPACITY_LITERS = 60;
+
+	Peugeot3008ICluster(CanBus &canBus) : Cluster(canBus) {}
+
+	void setup() override;
+
+	void updateState(State &state) override;
+
+	uint8_t getTankCapacityLiters() const override {
+		return TANK_CAPACITY_LITERS;
+	}
+
+	ExpeditedFrameStatus updateRpmAndSpeed(State &state) override;
+
+	bool isRpmAndSpeedDeferred() const override {
+		return scheduler.rpmAndSpeed.isExpedited();
+	}
+
+private:
+	peugeot_3008_i::Scheduler scheduler;
+};
+
+void Peugeot3008ICluster::setup() {
+	canBus.setup(125000);
 }
 
-void Cluster::updateState(State &state) {
+void Peugeot3008ICluster::updateState(State &state) {
+	using namespace peugeot_3008_i;
+
+	// Lights blinked by the Arduino toggle as soon as the phase does, not at the next frame
+	uint16_t blinkPhase = BlinkClock::getPhase();
+	if (blinkPhase != scheduler.blinkPhase) {
+		scheduler.blinkPhase = blinkPhase;
+		if (state.batteryNotChargingLightStatus == LightStatus::BLINKING) {
+			scheduler.warningLights.expedite();
+		}
+	}
+
 	sendIgnitionAndLighting(
+		canBus,
+		scheduler.ignitionAndLighting,
 		state.economyModeEnabled,
 		state.dashboardLightingEnabled,
 		state.dashboardBrightness,
@@ -28,11 +86,15 @@ void Cluster::updateState(State &state) {
 	);
 
     sendRpmAndSpeed(
+		canBus,
+		scheduler.rpmAndSpeed,
 		state.rpm,
 		state.speedKmh
 	);
 
 	sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+		canBus,
+		scheduler.ignitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals,
 		state.ignitionState,
 		state.darkModeEnabled,
 		state.engineCoolantTemperatureCelsius,
@@ -43,6 +105,8 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendDashboardLights(
+		canBus,
+		scheduler.dashboardLights,
 		state.dieselGlowPlugsLight,
 		state.lowFuel,
 		state.parkingBrakeLightStatus,
@@ -57,11 +121,15 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendFuelAndOil(
+		canBus,
+		scheduler.fuelAndOil,
 		state.fuelLevelPercentage,
 		state.engineOilLevel
 	);
 
 	sendWarningLights(
+		canBus,
+		scheduler.warningLights,
 		state.parkingBrakeLightStatus,
 		state.engineOilLevel,
 		state.highEngineCoolantTemperatureLightStatus,
@@ -74,10 +142,28 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendTripMeter(
+		canBus,
+		scheduler.tripMeter,
 		state.currentTrip
 	);
 
 	sendLocalization(
+		canBus,
+		scheduler.localization,
 		state.locale
 	);
 }
+
+ExpeditedFrameStatus Peugeot3008ICluster::updateRpmAndSpeed(State &state) {
+	using namespace peugeot_3008_i;
+
+	scheduler.rpmAndSpeed.expedite();
+	sendRpmAndSpeed(
+		canBus,
+		scheduler.rpmAndSpeed,
+		state.rpm,
+		state.speedKmh
+	);
+
+	return scheduler.rpmAndSpeed.isExpedited() ? ExpeditedFrameStatus::DEFERRED : ExpeditedFrameStatus::SENT;
+}
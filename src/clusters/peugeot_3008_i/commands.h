@@ -5,20 +5,38 @@
 
 #pragma once
 
-#include <mcp2515.h>
 #include <stdint.h>
+#include "../../BlinkClock.h"
+#include "../../CanBus.h"
 #include "../../MessageDebouncer.h"
 #include "../../types.h"
 
-static MCP2515 mcp2515(10);
+namespace peugeot_3008_i {
+
+/**
+ * Message debouncers of a single cluster instance, one per CAN frame.
+ */
+struct Scheduler {
+	MessageDebouncer ignitionAndLighting{100};
+	MessageDebouncer rpmAndSpeed{20, 10};
+	MessageDebouncer ignitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals{500};
+	MessageDebouncer dashboardLights{200};
+	MessageDebouncer fuelAndOil{500};
+	MessageDebouncer warningLights{200};
+	MessageDebouncer tripMeter{100}; // Should be 200ms, decreasing to fix no data
+	MessageDebouncer localization{1000};
+	// Blink phase the frames with blinking lights have last been sent in
+	uint16_t blinkPhase = 0;
+};
 
 static void sendIgnitionAndLighting(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	bool economyModeEnabled,
 	bool dashboardLightingEnabled,
 	uint8_t dashboardBrightness,
 	IgnitionState ignitionState
 ) {
-	static MessageDebouncer messageDebouncer(100);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -41,14 +59,35 @@ static void sendIgnitionAndLighting(
 	frame.data[6] = 0x00;
 	frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeIgnitionAndLighting(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.economyModeEnabled = frame.data[2] & 0x80;
+	state.dashboardLightingEnabled = frame.data[3] & 0x20;
+	state.dashboardBrightness = frame.data[3] & 0x0F;
+	switch (frame.data[4] & 0x03) {
+		case 0x01:
+			state.ignitionState = IgnitionState::ON;
+			break;
+		case 0x02:
+			state.ignitionState = IgnitionState::OFF;
+			break;
+		default:
+			state.ignitionState = IgnitionState::ACC;
+			break;
+	}
 }
 
 static void sendRpmAndSpeed(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	int rpm,
 	int speedKmh
 ) {
-	static MessageDebouncer messageDebouncer(50);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -69,10 +108,23 @@ static void sendRpmAndSpeed(
 	frame.data[6] = 0x00; // Does nothing
 	frame.data[7] = 0x00; // Used for immobilizer, ignore
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeRpmAndSpeed(
+	const struct can_frame &frame,
+	State &state
+) {
+	uint16_t rpmData = (uint16_t)frame.data[0] << 8 | frame.data[1];
+	uint16_t speedData = (uint16_t)frame.data[2] << 8 | frame.data[3];
+
+	state.rpm = rpmData >> 3;
+	state.speedKmh = speedData / 100;
 }
 
 static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	IgnitionState ignitionState,
 	bool darkModeEnabled,
 	int engineCoolantTemperatureCelsius,
@@ -81,7 +133,6 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 	Headlights &headlights,
 	Gear gear
 ) {
-	static MessageDebouncer messageDebouncer(500);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -107,10 +158,34 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 		| (headlights.rightIndicator ? 0x02 : 0x00) // Bit 1: Turn right
 		| (headlights.leftIndicator ? 0x01 : 0x00); // Bit 0: Turn left
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.engineCoolantTemperatureCelsius = frame.data[1] - 40;
+
+	uint32_t odometerData = (uint32_t)frame.data[2] << 16 | (uint32_t)frame.data[3] << 8 | frame.data[4];
+
+	// Ignition is taken from 0x036, which tells OFF and ACC apart
+	state.darkModeEnabled = frame.data[0] & 0x10;
+	state.odometerKm = odometerData / 10;
+	// The data of temperatures below 79 °C wraps around below 0
+	state.ambientTemperatureCelsius = (int8_t)frame.data[5] * 2 + 79;
+	if (frame.data[7] & 0x80) {
+		state.gear = Gear::GEAR_R;
+	} else if (state.gear == Gear::GEAR_R) {
+		state.gear = Gear::GEAR_HIDDEN;
+	}
+	state.headlights.rightIndicator = frame.data[7] & 0x02;
+	state.headlights.leftIndicator = frame.data[7] & 0x01;
 }
 
 static void sendDashboardLights(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	bool dieselGlowPlugsLight,
 	bool lowFuel,
 	LightStatus parkingBrakeLightStatus,
@@ -123,7 +198,6 @@ static void sendDashboardLights(
 	Headlights &headlights,
 	bool automaticParkingBrakeDisabled
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -162,14 +236,44 @@ static void sendDashboardLights(
 	frame.data[6] = 0x00; // Does nothing
 	frame.data[7] = 0x00; // Does nothing
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeDashboardLights(
+	const struct can_frame &frame,
+	State &state
+) {
+	// Parking brake light is taken from 0x168, which has blinking as well
+	state.lowFuel = frame.data[0] & 0x10;
+	state.dieselGlowPlugsLight = frame.data[0] & 0x04;
+	state.serviceWarning = frame.data[1] & 0x80;
+	state.stopWarning = frame.data[1] & 0x40;
+	state.anyDoorOpen = frame.data[1] & 0x10;
+	state.tcStatus = frame.data[2] & 0x10
+		? FeatureStatus::DISABLED
+		: frame.data[2] & 0x08 ? FeatureStatus::ACTIVE : FeatureStatus::ENABLED;
+	state.parkAssistLightStatus = frame.data[3] & 0x08
+		? LightStatus::BLINKING
+		: frame.data[3] & 0x10 ? LightStatus::ON : LightStatus::OFF;
+	state.pressBrakePedalLightStatus = frame.data[3] & 0x04
+		? LightStatus::BLINKING
+		: frame.data[3] & 0x02 ? LightStatus::ON : LightStatus::OFF;
+	state.headlights.sidelights = frame.data[4] & 0x80;
+	state.headlights.lowBeam = frame.data[4] & 0x40;
+	state.headlights.highBeam = frame.data[4] & 0x20;
+	state.headlights.frontFogLights = frame.data[4] & 0x10;
+	state.headlights.rearFogLights = frame.data[4] & 0x08;
+	state.headlights.rightIndicator = frame.data[4] & 0x04;
+	state.headlights.leftIndicator = frame.data[4] & 0x02;
+	state.automaticParkingBrakeDisabled = frame.data[5] & 0x01;
 }
 
 static void sendFuelAndOil(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	uint8_t fuelLevelPercentage,
 	EngineOilLevel engineOilLevel
 ) {
-	static MessageDebouncer messageDebouncer(500);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -187,10 +291,25 @@ static void sendFuelAndOil(
 	frame.data[6] = engineOilLevel == EngineOilLevel::UNKNOWN ? 0xFF : 0x00; // 0xFF: Oil reading invalid
 	//frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeFuelAndOil(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.fuelLevelPercentage = frame.data[3] == 0xFF ? 0 : frame.data[3];
+	// Oil level not ok is taken from 0x168
+	if (frame.data[6] == 0xFF) {
+		state.engineOilLevel = EngineOilLevel::UNKNOWN;
+	} else if (state.engineOilLevel == EngineOilLevel::UNKNOWN) {
+		state.engineOilLevel = EngineOilLevel::OK;
+	}
 }
 
 static void sendWarningLights(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	LightStatus parkingBrakeLightStatus,
 	EngineOilLevel engineOilLevel,
 	LightStatus highEngineCoolantTemperatureLightStatus,
@@ -201,7 +320,6 @@ static void sendWarningLights(
 	bool airbagWarning,
 	bool automaticParkingBrakeIssue
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -225,8 +343,8 @@ static void sendWarningLights(
 	frame.data[4] = 0x00
 		| (airbagWarning ? 0x20 : 0x00) // Bit 5: Airbag warning light
 		| (checkEngineLightStatus == LightStatus::BLINKING ? 0x10 : 0x00) // Bit 4: Check engine light blink
-		| (batteryNotChargingLightStatus == LightStatus::ON ? 0x04 : 0x00) // Bit 2: Battery not charging light
-		| (batteryNotChargingLightStatus == LightStatus::ON ? 0x02 : 0x00); // Bit 1: Battery not charging light
+		| (BlinkClock::isLit(batteryNotChargingLightStatus) ? 0x04 : 0x00) // Bit 2: Battery not charging light
+		| (BlinkClock::isLit(batteryNotChargingLightStatus) ? 0x02 : 0x00); // Bit 1: Battery not charging light
 	frame.data[5] = 0x00
 		| (false ? 0x04 : 0x00); // Bit 2: Low beams warning light
 	frame.data[6] = 0x00
@@ -235,13 +353,39 @@ static void sendWarningLights(
 	frame.data[7] = 0x00
 		| (checkEngineLightStatus == LightStatus::BLINKING ? 0x40 : 0x00); // Bit 6: Check engine light blink
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeWarningLights(
+	const struct can_frame &frame,
+	State &state
+) {
+	// ESP is taken from 0x128, which has all its states
+	state.highEngineCoolantTemperatureLightStatus = frame.data[0] & 0x20
+		? LightStatus::BLINKING
+		: frame.data[0] & 0x80 ? LightStatus::ON : LightStatus::OFF;
+	if (frame.data[0] & 0x08) {
+		state.engineOilLevel = EngineOilLevel::NOT_OK;
+	} else if (state.engineOilLevel == EngineOilLevel::NOT_OK) {
+		state.engineOilLevel = EngineOilLevel::OK;
+	}
+	state.parkingBrakeLightStatus = frame.data[6] & 0x08
+		? LightStatus::BLINKING
+		: frame.data[0] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.absStatus = frame.data[3] & 0x20 ? FeatureStatus::DISABLED : FeatureStatus::ENABLED;
+	state.checkEngineLightStatus = frame.data[4] & 0x10
+		? LightStatus::BLINKING
+		: frame.data[3] & 0x02 ? LightStatus::ON : LightStatus::OFF;
+	state.airbagWarning = frame.data[4] & 0x20;
+	state.batteryNotChargingLightStatus = frame.data[4] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.automaticParkingBrakeIssue = frame.data[6] & 0x10;
 }
 
 static void sendTripMeter(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Trip &currentTrip
 ) {
-	static MessageDebouncer messageDebouncer(100); // Should be 200ms, decreasing to fix no data
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -261,13 +405,21 @@ static void sendTripMeter(
 	frame.data[6] = currentTrip.distanceMeters >> 8 & 0xFF;
 	frame.data[7] = currentTrip.distanceMeters & 0xFF;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeTripMeter(
+	const struct can_frame &frame,
+	State &state
+) {
+	state.currentTrip.distanceMeters = (uint32_t)frame.data[5] << 16 | (uint32_t)frame.data[6] << 8 | frame.data[7];
 }
 
 static void sendLocalization(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Locale &locale
 ) {
-	static MessageDebouncer messageDebouncer(1000);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -402,5 +554,139 @@ static void sendLocalization(
 	frame.data[6] = languageData; // Bit 0-3: Language
 	//frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
 }
+
+[[maybe_unused]] static void decodeLocalization(
+	const struct can_frame &frame,
+	State &state
+) {
+	uint8_t unitsData = frame.data[5];
+	Locale &locale = state.locale;
+
+	locale.timeDisplayMode = unitsData & 0x80 ? TimeDisplayMode::MODE_24_HOUR : TimeDisplayMode::MODE_12_HOUR;
+	locale.temperatureUnit = unitsData & 0x20 ? TemperatureUnit::FAHRENHEIT : TemperatureUnit::CELSIUS;
+	locale.pressureUnit = unitsData & 0x08 ? PressureUnit::PSI : PressureUnit::BAR;
+	locale.consumptionUnit = unitsData & 0x04
+		? ConsumptionUnit::DISTANCE_PER_VOLUME
+		: ConsumptionUnit::VOLUME_PER_DISTANCE;
+	locale.volumeUnit = unitsData & 0x02 ? VolumeUnit::GALLONS : VolumeUnit::LITERS;
+	locale.distanceUnit = unitsData & 0x01 ? DistanceUnit::MILES : DistanceUnit::KILOMETERS;
+
+	switch (frame.data[6] & 0x0F) {
+		case 0x00:
+			locale.language = Language::FRENCH;
+			break;
+		case 0x02:
+			locale.language = Language::GERMAN;
+			break;
+		case 0x03:
+			locale.language = Language::SPANISH;
+			break;
+		case 0x04:
+			locale.language = Language::ITALIAN;
+			break;
+		case 0x05:
+			locale.language = Language::PORTUGUESE;
+			break;
+		case 0x06:
+			locale.language = Language::DUTCH;
+			break;
+		case 0x07:
+			locale.language = Language::GREEK;
+			break;
+		case 0x08:
+			locale.language = Language::BRASILIAN_PORTUGUESE;
+			break;
+		case 0x09:
+			locale.language = Language::POLISH;
+			break;
+		case 0x0A:
+			locale.language = Language::TRADITIONAL_CHINESE;
+			break;
+		case 0x0B:
+			locale.language = Language::SIMPLIFIED_CHINESE;
+			break;
+		case 0x0C:
+			locale.language = Language::TURKISH;
+			break;
+		case 0x0E:
+			locale.language = Language::RUSSIAN;
+			break;
+		case 0x01:
+		default:
+			locale.language = Language::ENGLISH;
+			break;
+	}
+}
+
+
+/**
+ * Decode a frame of this cluster back into the state fields it carries, the inverse of the send
+ * functions (up to the resolution of the frame).
+ *
+ * @return true if the frame is known and has been decoded, false otherwise
+ */
+[[maybe_unused]] static bool decodeFrame(
+	const struct can_frame &frame,
+	State &state
+) {
+	if (frame.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG)) {
+		return false;
+	}
+
+	switch (frame.can_id) {
+		case 0x036:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeIgnitionAndLighting(frame, state);
+			return true;
+		case 0x0B6:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeRpmAndSpeed(frame, state);
+			return true;
+		case 0x0F6:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(frame, state);
+			return true;
+		case 0x128:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeDashboardLights(frame, state);
+			return true;
+		case 0x161:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeFuelAndOil(frame, state);
+			return true;
+		case 0x168:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeWarningLights(frame, state);
+			return true;
+		case 0x1A8:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeTripMeter(frame, state);
+			return true;
+		case 0x3F6:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeLocalization(frame, state);
+			return true;
+		default:
+			return false;
+	}
+}
+
+} // namespace peugeot_3008_i
@@ -9,18 +9,76 @@
  * Peugeot multifunction display manager.
  */
 
+#include "../../CanBus.h"
 #include "../../Cluster.h"
+#include "../../StateFields.h"
 #include "../../types.h"
 #include "commands.h"
 
-void Cluster::setup() {
-	mcp2515.reset();
-	mcp2515.setBitrate(CAN_125KBPS, MCP_8MHZ);
-	mcp2515.setNormalMode();
+class PeugeotMultifunctionDisplayCluster : public Cluster {
+public:
+	/**
+	 * The State fields updateState() uses, only these are sent by SimHub.
+	 */
+	static constexpr StateFieldMask CONSUMED_FIELDS
+		= LOCALE_FIELDS
+		| stateFieldBit(StateField::IGNITION)
+		| stateFieldBit(StateField::COOLANT_TEMPERATURE)
+		| stateFieldBit(StateField::AMBIENT_TEMPERATURE)
+		| stateFieldBit(StateField::ODOMETER)
+		| stateFieldBit(StateField::INSTANT_FUEL_CONSUMPTION)
+		| stateFieldBit(StateField::GEAR)
+		| INDICATORS_FIELDS
+		| stateFieldBit(StateField::TC_ACTIVE)
+		| stateFieldBit(StateField::ABS_ACTIVE)
+		| TRIP_COMPUTER_FIELDS;
+
+	/**
+	 * Fuel tank capacity of the car, e.g. the Peugeot 308 I one, set it to your car's for an accurate
+	 * range.
+	 */
+	static constexpr uint8_t TANK_CAPACITY_LITERS = 60;
+
+	PeugeotMultifunctionDisplayCluster(CanBus &canBus) : Cluster(canBus) {}
+
+	void setup() override;
+
+	void updateState(State &state) override;
+
+	uint8_t getTankCapacityLiters() const override {
+		return TANK_CAPACITY_LITERS;
+	}
+
+private:
+	peugeot_multifunction_display::Scheduler scheduler;
+};
+
+void PeugeotMultifunctionDisplayCluster::setup() {
+	canBus.setup(125000);
 }
 
-void Cluster::updateState(State &state) {
+void PeugeotMultifunctionDisplayCluster::updateState(State &state) {
+	using namespace peugeot_multifunction_display;
+
+	// Lights blinked by the Arduino toggle as soon as the phase does, not at the next frame
+	uint16_t blinkPhase = BlinkClock::getPhase();
+	if (blinkPhase != scheduler.blinkPhase) {
+		scheduler.blinkPhase = blinkPhase;
+		if (state.driverSeatBeltsStatus == LightStatus::BLINKING
+			|| state.passengerSeatBeltsStatus == LightStatus::BLINKING
+			|| state.rearLeftSeatBeltsStatus == LightStatus::BLINKING
+			|| state.rearCenterSeatBeltsStatus == LightStatus::BLINKING
+			|| state.rearRightSeatBeltsStatus == LightStatus::BLINKING) {
+			scheduler.dashboardLights.expedite();
+		}
+		if (state.highEngineCoolantTemperatureLightStatus == LightStatus::BLINKING) {
+			scheduler.warningLights.expedite();
+		}
+	}
+
 	sendIgnitionAndLighting(
+		canBus,
+		scheduler.ignitionAndLighting,
 		state.economyModeEnabled,
 		state.dashboardLightingEnabled,
 		state.dashboardBrightness,
@@ -28,6 +86,8 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+		canBus,
+		scheduler.ignitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals,
 		state.ignitionState,
 		state.darkModeEnabled,
 		state.engineCoolantTemperatureCelsius,
@@ -38,6 +98,8 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendDashboardLights(
+		canBus,
+		scheduler.dashboardLights,
 		state.passengerSeatBeltsStatus,
 		state.dieselGlowPlugsLight,
 		state.lowFuel,
@@ -58,10 +120,14 @@ void Cluster::updateState(State &state) {
 	);
 
 	sendOilOk(
+		canBus,
+		scheduler.oilOk,
 		state.engineOilLevel
 	);
 
 	sendWarningLights(
+		canBus,
+		scheduler.warningLights,
 		state.parkingBrakeLightStatus,
 		state.engineOilLevel,
 		state.highEngineCoolantTemperatureLightStatus,
@@ -73,20 +139,35 @@ void Cluster::updateState(State &state) {
 		state.automaticParkingBrakeIssue
 	);
 
-	sendInformationalMessage();
+	sendInformationalMessage(
+		canBus,
+		scheduler.informationalMessage
+	);
 
 	sendTripComputerInfo(
+		canBus,
+		scheduler.tripComputerInfo,
+		scheduler.tripButtonPushStatus,
 		false, // tripButtonPushed
-		state.instantFuelConsumptionLP100Km,
-		state.remainingFuelDistanceKm,
-		state.remainingTripDistanceKm
+		state.instantFuelConsumptionDeciLP100Km,
+		state.remainingFuelDistanceKm
 	);
 
-	sendTrip2(state.lastTrip);
+	sendTrip2(
+		canBus,
+		scheduler.trip2,
+		state.lastTrip
+	);
 
-	sendTrip1(state.currentTrip);
+	sendTrip1(
+		canBus,
+		scheduler.trip1,
+		state.currentTrip
+	);
 
 	sendLocalization(
+		canBus,
+		scheduler.localization,
 		state.locale
 	);
 }
@@ -5,20 +5,45 @@
 
 #pragma once
 
-#include <mcp2515.h>
 #include <stdint.h>
+#include "../../BlinkClock.h"
+#include "../../CanBus.h"
+#include "../../Cluster.h"
 #include "../../MessageDebouncer.h"
 #include "../../types.h"
 
-static MCP2515 mcp2515(10);
+namespace peugeot_multifunction_display {
+
+/**
+ * Message debouncers of a single cluster instance, one per CAN frame.
+ */
+struct Scheduler {
+	MessageDebouncer ignitionAndLighting{100};
+	MessageDebouncer rpmAndSpeed{50};
+	MessageDebouncer ignitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals{500};
+	MessageDebouncer dashboardLights{200};
+	MessageDebouncer oilOk{500};
+	MessageDebouncer warningLights{200};
+	MessageDebouncer informationalMessage{200};
+	MessageDebouncer tripComputerInfo{1000};
+	MessageDebouncer trip2{1000};
+	MessageDebouncer trip1{1000};
+	MessageDebouncer localization{1000};
+
+	// Keeps track of the trip button push status until the next 0x221 message
+	bool tripButtonPushStatus = false;
+	// Blink phase the frames with blinking lights have last been sent in
+	uint16_t blinkPhase = 0;
+};
 
 static void sendIgnitionAndLighting(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	bool economyModeEnabled,
 	bool dashboardLightingEnabled,
 	uint8_t dashboardBrightness,
 	IgnitionState ignitionState
 ) {
-	static MessageDebouncer messageDebouncer(100);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -41,38 +66,32 @@ static void sendIgnitionAndLighting(
 	frame.data[6] = 0x00;
 	frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
 }
 
-static void sendRpmAndSpeed(
-	int rpm,
-	int speedKmh
+[[maybe_unused]] static void decodeIgnitionAndLighting(
+	const struct can_frame &frame,
+	State &state
 ) {
-	static MessageDebouncer messageDebouncer(50);
-	struct can_frame frame;
-
-	if (!messageDebouncer.shouldUpdate()) {
-		return;
+	state.economyModeEnabled = frame.data[2] & 0x80;
+	state.dashboardLightingEnabled = frame.data[3] & 0x20;
+	state.dashboardBrightness = frame.data[3] & 0x0F;
+	switch (frame.data[4] & 0x03) {
+		case 0x01:
+			state.ignitionState = IgnitionState::ON;
+			break;
+		case 0x02:
+			state.ignitionState = IgnitionState::OFF;
+			break;
+		default:
+			state.ignitionState = IgnitionState::ACC;
+			break;
 	}
-
-	uint16_t rpmData = rpm << 3;
-	uint16_t speedData = speedKmh * 100;
-
-	frame.can_id = 0x0B6;
-	frame.can_dlc = 8;
-	frame.data[0] = rpmData >> 8 & 0xFF; // RPM
-	frame.data[1] = rpmData & 0xFF; // RPM
-	frame.data[2] = speedData >> 8 & 0xFF; // Speed (km/h * 100)
-	frame.data[3] = speedData & 0xFF; // Speed (km/h * 100)
-	frame.data[4] = 0x00; // Odometer from start (cm)
-	frame.data[5] = 0x00; // Odometer from start (cm)
-	frame.data[6] = 0x00; // Fuel consumption
-	frame.data[7] = 0x00; // Does nothing
-
-	mcp2515.sendMessage(&frame);
 }
 
 static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	IgnitionState ignitionState,
 	bool darkModeEnabled,
 	int engineCoolantTemperatureCelsius,
@@ -81,7 +100,6 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 	Headlights &headlights,
 	Gear gear
 ) {
-	static MessageDebouncer messageDebouncer(500);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -92,11 +110,11 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 	if (engineCoolantTemperatureCelsius <= 90) {
 		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 130) / 2;
 	} else if (engineCoolantTemperatureCelsius <= 100) {
-		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius - 62.5) * 4;
+		engineCoolantTemperatureData = engineCoolantTemperatureCelsius * 4 - 250;
 	} else if (engineCoolantTemperatureCelsius <= 110) {
 		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 200) / 2;
 	} else if (engineCoolantTemperatureCelsius <= 130) {
-		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 946) / 6.7;
+		engineCoolantTemperatureData = (engineCoolantTemperatureCelsius + 946) * 10 / 67; // / 6.7
 	} else {
 		engineCoolantTemperatureData = 160; // Clamp to 130 °C
 	}
@@ -121,10 +139,46 @@ static void sendIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurn
 		| (headlights.rightIndicator ? 0x02 : 0x00) // Bit 1: Turn right
 		| (headlights.leftIndicator ? 0x01 : 0x00); // Bit 0: Turn left
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(
+	const struct can_frame &frame,
+	State &state
+) {
+	// The lowest temperature of each step, the one the cluster starts showing it at
+	uint8_t engineCoolantTemperatureData = frame.data[1];
+	if (engineCoolantTemperatureData <= 110) {
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureData * 2 - 130;
+	} else if (engineCoolantTemperatureData <= 150) {
+		state.engineCoolantTemperatureCelsius = (engineCoolantTemperatureData + 250) / 4;
+	} else if (engineCoolantTemperatureData <= 155) {
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureData * 2 - 200;
+	} else {
+		// Rounded up, the first whole degree of the 6.7 °C step
+		int16_t engineCoolantTemperatureCelsius = (engineCoolantTemperatureData * 67 - 9460 + 9) / 10;
+		state.engineCoolantTemperatureCelsius = engineCoolantTemperatureCelsius < 111 ? 111 : engineCoolantTemperatureCelsius;
+	}
+
+	uint32_t odometerData = (uint32_t)frame.data[2] << 16 | (uint32_t)frame.data[3] << 8 | frame.data[4];
+
+	// Ignition is taken from 0x036, which tells OFF and ACC apart
+	state.darkModeEnabled = frame.data[0] & 0x10;
+	state.odometerKm = odometerData / 10;
+	// The data of temperatures below 79 °C wraps around below 0
+	state.ambientTemperatureCelsius = (int8_t)frame.data[5] * 2 + 79;
+	if (frame.data[7] & 0x80) {
+		state.gear = Gear::GEAR_R;
+	} else if (state.gear == Gear::GEAR_R) {
+		state.gear = Gear::GEAR_HIDDEN;
+	}
+	state.headlights.rightIndicator = frame.data[7] & 0x02;
+	state.headlights.leftIndicator = frame.data[7] & 0x01;
 }
 
 static void sendDashboardLights(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	LightStatus passengerSeatBeltsStatus,
 	bool dieselGlowPlugsLight,
 	bool lowFuel,
@@ -143,7 +197,6 @@ static void sendDashboardLights(
 	bool autoGearSelection,
 	bool sportMode
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -211,11 +264,11 @@ static void sendDashboardLights(
 	frame.can_id = 0x128; // 0x928 is also accepted
 	frame.can_dlc = 8;
 	frame.data[0] = 0x00
-		| (driverSeatBeltsStatus != LightStatus::OFF ? 0x40 : 0x00) // Bit 6: Driver seat belts
+		| (BlinkClock::isLit(driverSeatBeltsStatus) ? 0x40 : 0x00) // Bit 6: Driver seat belts
 		| (parkingBrakeLightStatus == LightStatus::ON ? 0x20 : 0x00) // Bit 5: Parking brake light
 		| (lowFuel ? 0x10 : 0x00) // Bit 4: Low fuel light
 		| (dieselGlowPlugsLight ? 0x04 : 0x00) // Bit 2: Diesel glow plug light
-		| (passengerSeatBeltsStatus != LightStatus::OFF ? 0x02 : 0x00); // Bit 1: Passenger seat belts
+		| (BlinkClock::isLit(passengerSeatBeltsStatus) ? 0x02 : 0x00); // Bit 1: Passenger seat belts
 	frame.data[1] = 0x00
 		| (serviceWarning ? 0x80 : 0x00) // Bit 7: Service light
 		| (stopWarning ? 0x40 : 0x00); // Bit 6: Stop light on
@@ -232,9 +285,9 @@ static void sendDashboardLights(
 		| (headlights.rightIndicator ? 0x04 : 0x00) // Bit 2: Right indicator
 		| (headlights.leftIndicator ? 0x02 : 0x00); // Bit 1: Left indicator
 	frame.data[5] = 0x00 // TODO: Blinks on 0xF0, 0xE0 and 0x70, it possibly remembers seat belts status
-		| (rearLeftSeatBeltsStatus != LightStatus::OFF ? 0x40 : 0x00) // Bit 6: Rear left seat belts
-		| (rearCenterSeatBeltsStatus != LightStatus::OFF ? 0x10 : 0x00) // Bit 4: Rear center seat belts
-		| (rearRightSeatBeltsStatus != LightStatus::OFF ? 0x04 : 0x00) // Bit 2: Rear right seat belts
+		| (BlinkClock::isLit(rearLeftSeatBeltsStatus) ? 0x40 : 0x00) // Bit 6: Rear left seat belts
+		| (BlinkClock::isLit(rearCenterSeatBeltsStatus) ? 0x10 : 0x00) // Bit 4: Rear center seat belts
+		| (BlinkClock::isLit(rearRightSeatBeltsStatus) ? 0x04 : 0x00) // Bit 2: Rear right seat belts
 		| (automaticParkingBrakeDisabled ? 0x01 : 0x00); // Bit 0: Automatic parking brake disabled
 	frame.data[6] = gearData // Bit 7-4: Gear type (P, R, N, D, 1-6), Bit 3-1: D gear number
 		| (blinkingGear ? 0x01 : 0x00); // Bit 0: Blinking indicator
@@ -243,13 +296,84 @@ static void sendDashboardLights(
 		| (autoGearSelection ? 0x02 : 0x00) // Bit 1: Auto gear selection for automated manual transmission
 		| (gear == Gear::GEAR_HIDDEN ? 0x01 : 0x00); // Bit 0: Hide gear indicator
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static Gear decodeGear(uint8_t gearData) {
+	switch (gearData & 0xFE) {
+		case 0x00:
+			return Gear::GEAR_P;
+		case 0x10:
+			return Gear::GEAR_R;
+		case 0x20:
+			return Gear::GEAR_N;
+		case 0x30:
+			return Gear::GEAR_D;
+		case 0x32:
+			return Gear::GEAR_D_1;
+		case 0x34:
+			return Gear::GEAR_D_2;
+		case 0x36:
+			return Gear::GEAR_D_3;
+		case 0x38:
+			return Gear::GEAR_D_4;
+		case 0x3A:
+			return Gear::GEAR_D_5;
+		case 0x3C:
+			return Gear::GEAR_D_6;
+		case 0x90:
+			return Gear::GEAR_1;
+		case 0x80:
+			return Gear::GEAR_2;
+		case 0x70:
+			return Gear::GEAR_3;
+		case 0x60:
+			return Gear::GEAR_4;
+		case 0x50:
+			return Gear::GEAR_5;
+		case 0x40:
+			return Gear::GEAR_6;
+		default:
+			return Gear::GEAR_HIDDEN;
+	}
+}
+
+[[maybe_unused]] static void decodeDashboardLights(
+	const struct can_frame &frame,
+	State &state
+) {
+	// Parking brake light is taken from 0x168, which has blinking as well
+	state.driverSeatBeltsStatus = frame.data[0] & 0x40 ? LightStatus::ON : LightStatus::OFF;
+	state.lowFuel = frame.data[0] & 0x10;
+	state.dieselGlowPlugsLight = frame.data[0] & 0x04;
+	state.passengerSeatBeltsStatus = frame.data[0] & 0x02 ? LightStatus::ON : LightStatus::OFF;
+	state.serviceWarning = frame.data[1] & 0x80;
+	state.stopWarning = frame.data[1] & 0x40;
+	state.tcStatus = frame.data[2] & 0x10
+		? FeatureStatus::DISABLED
+		: frame.data[2] & 0x08 ? FeatureStatus::ACTIVE : FeatureStatus::ENABLED;
+	state.headlights.sidelights = frame.data[4] & 0x80;
+	state.headlights.lowBeam = frame.data[4] & 0x40;
+	state.headlights.highBeam = frame.data[4] & 0x20;
+	state.headlights.frontFogLights = frame.data[4] & 0x10;
+	state.headlights.rearFogLights = frame.data[4] & 0x08;
+	state.headlights.rightIndicator = frame.data[4] & 0x04;
+	state.headlights.leftIndicator = frame.data[4] & 0x02;
+	state.rearLeftSeatBeltsStatus = frame.data[5] & 0x40 ? LightStatus::ON : LightStatus::OFF;
+	state.rearCenterSeatBeltsStatus = frame.data[5] & 0x10 ? LightStatus::ON : LightStatus::OFF;
+	state.rearRightSeatBeltsStatus = frame.data[5] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.automaticParkingBrakeDisabled = frame.data[5] & 0x01;
+	state.gear = frame.data[7] & 0x01 ? Gear::GEAR_HIDDEN : decodeGear(frame.data[6]);
+	state.blinkingGear = frame.data[6] & 0x01;
+	state.sportMode = frame.data[7] & 0x20;
+	state.autoGearSelection = frame.data[7] & 0x02;
 }
 
 static void sendOilOk(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	EngineOilLevel engineOilLevel
 ) {
-	static MessageDebouncer messageDebouncer(500);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -267,10 +391,24 @@ static void sendOilOk(
 	frame.data[6] = engineOilLevel == EngineOilLevel::UNKNOWN ? 0xFF : 0x00; // 0xFF: Oil reading invalid
 	//frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeOilOk(
+	const struct can_frame &frame,
+	State &state
+) {
+	// Oil level not ok is taken from 0x168
+	if (frame.data[6] == 0xFF) {
+		state.engineOilLevel = EngineOilLevel::UNKNOWN;
+	} else if (state.engineOilLevel == EngineOilLevel::UNKNOWN) {
+		state.engineOilLevel = EngineOilLevel::OK;
+	}
 }
 
 static void sendWarningLights(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	LightStatus parkingBrakeLightStatus,
 	EngineOilLevel engineOilLevel,
 	LightStatus highEngineCoolantTemperatureLightStatus,
@@ -281,7 +419,6 @@ static void sendWarningLights(
 	LightStatus batteryNotChargingLightStatus,
 	bool automaticParkingBrakeIssue
 ) {
-	static MessageDebouncer messageDebouncer(200);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -291,7 +428,7 @@ static void sendWarningLights(
 	frame.can_id = 0x168; // 0x968 is also accepted
 	frame.can_dlc = 8;
 	frame.data[0] = 0x00
-		| (highEngineCoolantTemperatureLightStatus != LightStatus::OFF ? 0x80 : 0x00) // Bit 7: High engine coolant temperature
+		| (BlinkClock::isLit(highEngineCoolantTemperatureLightStatus) ? 0x80 : 0x00) // Bit 7: High engine coolant temperature
 		| (engineOilLevel == EngineOilLevel::NOT_OK ? 0x10 : 0x00) // Bit 4: Engine oil level not ok
 		| (parkingBrakeLightStatus == LightStatus::ON ? 0x04 : 0x00); // Bit 2: Parking brake light
 	frame.data[1] = 0x00; // Does nothing
@@ -314,11 +451,38 @@ static void sendWarningLights(
 		| (batteryNotChargingLightStatus == LightStatus::BLINKING ? 0x80 : 0x00) // Bit 7: Battery not charging light blink
 		| (checkEngineLightStatus == LightStatus::BLINKING ? 0x40 : 0x00); // Bit 6: Check engine light blink
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
 }
 
-static void sendInformationalMessage() {
-	static MessageDebouncer messageDebouncer(200);
+[[maybe_unused]] static void decodeWarningLights(
+	const struct can_frame &frame,
+	State &state
+) {
+	// ESP is taken from 0x128, which has all its states
+	state.highEngineCoolantTemperatureLightStatus = frame.data[0] & 0x80 ? LightStatus::ON : LightStatus::OFF;
+	if (frame.data[0] & 0x10) {
+		state.engineOilLevel = EngineOilLevel::NOT_OK;
+	} else if (state.engineOilLevel == EngineOilLevel::NOT_OK) {
+		state.engineOilLevel = EngineOilLevel::OK;
+	}
+	state.parkingBrakeLightStatus = frame.data[6] & 0x08
+		? LightStatus::BLINKING
+		: frame.data[0] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.absStatus = frame.data[3] & 0x20 ? FeatureStatus::DISABLED : FeatureStatus::ENABLED;
+	state.sportAndWinterGearBlink = frame.data[3] & 0x08;
+	state.checkEngineLightStatus = frame.data[4] & 0x10
+		? LightStatus::BLINKING
+		: frame.data[3] & 0x02 ? LightStatus::ON : LightStatus::OFF;
+	state.batteryNotChargingLightStatus = frame.data[7] & 0x80
+		? LightStatus::BLINKING
+		: frame.data[4] & 0x04 ? LightStatus::ON : LightStatus::OFF;
+	state.automaticParkingBrakeIssue = frame.data[6] & 0x10;
+}
+
+static void sendInformationalMessage(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer
+) {
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -336,44 +500,52 @@ static void sendInformationalMessage() {
 	frame.data[6] = 0x00;
 	frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
 }
 
 static void sendTripComputerInfo(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
+	bool &tripButtonPushStatus,
 	bool tripButtonPushed,
-	uint16_t instantFuelConsumptionLP100Km,
-	uint16_t remainingFuelDistanceKm,
-	uint16_t remainingTripDistanceKm
+	uint16_t instantFuelConsumptionDeciLP100Km,
+	uint16_t remainingFuelDistanceKm
 ) {
-	static MessageDebouncer messageDebouncer(1000);
 	struct can_frame frame;
-	// Static variable to keep track of the trip button push status
-	static bool tripButtonPushStatus = tripButtonPushStatus || tripButtonPushed;
+
+	tripButtonPushStatus = tripButtonPushStatus || tripButtonPushed;
 
 	if (!messageDebouncer.shouldUpdate()) {
 		return;
 	}
 
-	uint16_t instantFuelConsumptionData = round(instantFuelConsumptionLP100Km * 10.0);
-
 	frame.can_id = 0x221;
 	frame.can_dlc = 7;
 	frame.data[0] = 0x00
 		| (tripButtonPushStatus ? 0x08 : 0x00); // Bit 3: Trip (right) push button
-	frame.data[1] = instantFuelConsumptionData >> 8 & 0xFF; // Instant fuel consumption in liters per 100 km
-	frame.data[2] = instantFuelConsumptionData & 0xFF; // Instant fuel consumption in liters per 100 km
+	frame.data[1] = instantFuelConsumptionDeciLP100Km >> 8 & 0xFF; // Instant fuel consumption in tenths of liter per 100 km
+	frame.data[2] = instantFuelConsumptionDeciLP100Km & 0xFF; // Instant fuel consumption in tenths of liter per 100 km
 	frame.data[3] = remainingFuelDistanceKm >> 8 & 0xFF; // Remaining range in km
 	frame.data[4] = remainingFuelDistanceKm & 0xFF; // Remaining range in km
-	frame.data[5] = remainingTripDistanceKm >> 8 & 0xFF; // Remaining trip distance in km
-	frame.data[6] = remainingTripDistanceKm & 0xFF; // Remaining trip distance in km
+	frame.data[5] = 0x00; // Remaining trip distance in km, needs a destination SimHub doesn't know
+	frame.data[6] = 0x00; // Remaining trip distance in km
 	//frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
 
 	// Reset trip button push status after sending the message
 	tripButtonPushStatus = false;
 }
 
+[[maybe_unused]] static void decodeTripComputerInfo(
+	const struct can_frame &frame,
+	State &state
+) {
+	// The trip button is handled as a CanButton
+	state.instantFuelConsumptionDeciLP100Km = (uint16_t)frame.data[1] << 8 | frame.data[2];
+	state.remainingFuelDistanceKm = (uint16_t)frame.data[3] << 8 | frame.data[4];
+}
+
 static struct can_frame sendTripN(
 	canid_t canId,
 	Trip &trip
@@ -381,7 +553,6 @@ static struct can_frame sendTripN(
 	struct can_frame frame;
 
 	uint16_t distanceKm = trip.distanceMeters / 1000;
-	uint16_t averageFuelConsumptionData = round(trip.averageFuelConsumptionLP100Km * 10.0);
 
 	// TODO: Is duration really in minutes?
 
@@ -390,8 +561,8 @@ static struct can_frame sendTripN(
 	frame.data[0] = trip.averageSpeedKmh; // Average speed in km/h
 	frame.data[1] = distanceKm >> 8 & 0xFF; // Trip meter in km
 	frame.data[2] = distanceKm & 0xFF; // Trip meter in km
-	frame.data[3] = averageFuelConsumptionData >> 8 & 0xFF; // Liters per 100 km
-	frame.data[4] = averageFuelConsumptionData & 0xFF; // Liters per 100 km
+	frame.data[3] = trip.averageFuelConsumptionDeciLP100Km >> 8 & 0xFF; // Tenths of liter per 100 km
+	frame.data[4] = trip.averageFuelConsumptionDeciLP100Km & 0xFF; // Tenths of liter per 100 km
 	frame.data[5] = trip.durationMinutes >> 8 & 0xFF; // Duration in minutes
 	frame.data[6] = trip.durationMinutes & 0xFF; // Duration in minutes
 	//frame.data[7] = 0x00;
@@ -399,10 +570,23 @@ static struct can_frame sendTripN(
 	return frame;
 }
 
+[[maybe_unused]] static void decodeTripN(
+	const struct can_frame &frame,
+	Trip &trip
+) {
+	uint16_t distanceKm = (uint16_t)frame.data[1] << 8 | frame.data[2];
+
+	trip.averageSpeedKmh = frame.data[0];
+	trip.distanceMeters = distanceKm * 1000;
+	trip.averageFuelConsumptionDeciLP100Km = (uint16_t)frame.data[3] << 8 | frame.data[4];
+	trip.durationMinutes = (uint16_t)frame.data[5] << 8 | frame.data[6];
+}
+
 static void sendTrip2(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Trip &trip
 ) {
-	static MessageDebouncer messageDebouncer(1000);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -411,13 +595,21 @@ static void sendTrip2(
 
 	frame = sendTripN(0x261, trip);
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeTrip2(
+	const struct can_frame &frame,
+	State &state
+) {
+	decodeTripN(frame, state.lastTrip);
 }
 
 static void sendTrip1(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Trip &trip
 ) {
-	static MessageDebouncer messageDebouncer(1000);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -426,13 +618,21 @@ static void sendTrip1(
 
 	frame = sendTripN(0x2A1, trip);
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
+}
+
+[[maybe_unused]] static void decodeTrip1(
+	const struct can_frame &frame,
+	State &state
+) {
+	decodeTripN(frame, state.currentTrip);
 }
 
 static void sendLocalization(
+	CanBus &canBus,
+	MessageDebouncer &messageDebouncer,
 	Locale &locale
 ) {
-	static MessageDebouncer messageDebouncer(1000);
 	struct can_frame frame;
 
 	if (!messageDebouncer.shouldUpdate()) {
@@ -567,5 +767,145 @@ static void sendLocalization(
 	frame.data[6] = languageData; // Bit 0-3: Language
 	//frame.data[7] = 0x00;
 
-	mcp2515.sendMessage(&frame);
+	canBus.sendMessage(&frame);
 }
+
+[[maybe_unused]] static void decodeLocalization(
+	const struct can_frame &frame,
+	State &state
+) {
+	uint8_t unitsData = frame.data[5];
+	Locale &locale = state.locale;
+
+	locale.timeDisplayMode = unitsData & 0x80 ? TimeDisplayMode::MODE_24_HOUR : TimeDisplayMode::MODE_12_HOUR;
+	locale.temperatureUnit = unitsData & 0x20 ? TemperatureUnit::FAHRENHEIT : TemperatureUnit::CELSIUS;
+	locale.pressureUnit = unitsData & 0x08 ? PressureUnit::PSI : PressureUnit::BAR;
+	locale.consumptionUnit = unitsData & 0x04
+		? ConsumptionUnit::DISTANCE_PER_VOLUME
+		: ConsumptionUnit::VOLUME_PER_DISTANCE;
+	locale.volumeUnit = unitsData & 0x02 ? VolumeUnit::GALLONS : VolumeUnit::LITERS;
+	locale.distanceUnit = unitsData & 0x01 ? DistanceUnit::MILES : DistanceUnit::KILOMETERS;
+
+	switch (frame.data[6] & 0x0F) {
+		case 0x00:
+			locale.language = Language::FRENCH;
+			break;
+		case 0x02:
+			locale.language = Language::GERMAN;
+			break;
+		case 0x03:
+			locale.language = Language::SPANISH;
+			break;
+		case 0x04:
+			locale.language = Language::ITALIAN;
+			break;
+		case 0x05:
+			locale.language = Language::PORTUGUESE;
+			break;
+		case 0x06:
+			locale.language = Language::DUTCH;
+			break;
+		case 0x07:
+			locale.language = Language::GREEK;
+			break;
+		case 0x08:
+			locale.language = Language::BRASILIAN_PORTUGUESE;
+			break;
+		case 0x09:
+			locale.language = Language::POLISH;
+			break;
+		case 0x0A:
+			locale.language = Language::TRADITIONAL_CHINESE;
+			break;
+		case 0x0B:
+			locale.language = Language::SIMPLIFIED_CHINESE;
+			break;
+		case 0x0C:
+			locale.language = Language::TURKISH;
+			break;
+		case 0x0E:
+			locale.language = Language::RUSSIAN;
+			break;
+		case 0x01:
+		default:
+			locale.language = Language::ENGLISH;
+			break;
+	}
+}
+
+
+/**
+ * Decode a frame of this cluster back into the state fields it carries, the inverse of the send
+ * functions (up to the resolution of the frame).
+ *
+ * @return true if the frame is known and has been decoded, false otherwise
+ */
+[[maybe_unused]] static bool decodeFrame(
+	const struct can_frame &frame,
+	State &state
+) {
+	if (frame.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG)) {
+		return false;
+	}
+
+	switch (frame.can_id) {
+		case 0x036:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeIgnitionAndLighting(frame, state);
+			return true;
+		case 0x0F6:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeIgnitionAndCoolantTempAndOdometerAndAmbientTempAndReverseAndTurnSignals(frame, state);
+			return true;
+		case 0x128:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeDashboardLights(frame, state);
+			return true;
+		case 0x161:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeOilOk(frame, state);
+			return true;
+		case 0x168:
+			if (frame.can_dlc < 8) {
+				return false;
+			}
+			decodeWarningLights(frame, state);
+			return true;
+		case 0x221:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeTripComputerInfo(frame, state);
+			return true;
+		case 0x261:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeTrip2(frame, state);
+			return true;
+		case 0x2A1:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeTrip1(frame, state);
+			return true;
+		case 0x3F6:
+			if (frame.can_dlc < 7) {
+				return false;
+			}
+			decodeLocalization(frame, state);
+			return true;
+		default:
+			return false;
+	}
+}
+
+} // namespace peugeot_multifunction_display
@@ -87,12 +87,12 @@ struct Trip {
 	/**
 	 * @brief Distance traveled in meters.
 	 */
-	uint16_t distanceMeters = 0;
+	uint32_t distanceMeters = 0;
 
 	/**
-	 * @brief Fuel consumption in liters per 100 km.
+	 * @brief Fuel consumption in tenths of liter per 100 km.
 	 */
-	float averageFuelConsumptionLP100Km = 0;
+	uint16_t averageFuelConsumptionDeciLP100Km = 0;
 
 	/**
 	 * @brief Duration of the trip in minutes.
@@ -180,9 +180,8 @@ struct State {
 	uint32_t odometerKm = 0;
 
 	// Instant consumption
-	float instantFuelConsumptionLP100Km = 0;
+	uint16_t instantFuelConsumptionDeciLP100Km = 0; // Tenths of liter per 100 km
 	uint16_t remainingFuelDistanceKm = 0;
-	uint16_t remainingTripDistanceKm = 0;
 
 	// Trips
 	Trip currentTrip = {};